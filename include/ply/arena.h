@@ -0,0 +1,31 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef _PLY_ARENA_H
+#define _PLY_ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+/* bump allocator, memory is only ever released all at once. */
+struct arena {
+	struct arena_chunk *chunks;
+};
+
+void *arena_alloc (struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *str);
+void  arena_free  (struct arena *a);
+
+/* nodes, symbols and the like are allocated from the arena of the
+ * ply that is currently being parsed or compiled. */
+struct arena *arena_enter(struct arena *a);
+void          arena_leave(struct arena *prev);
+
+void *acalloc(size_t nmemb, size_t size);
+char *astrdup(const char *str);
+
+#endif	/* _PLY_ARENA_H */
@@ -0,0 +1,47 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef _PLY_BTF_H
+#define _PLY_BTF_H
+
+#include <stdint.h>
+
+#include <linux/btf.h>
+
+struct btf {
+	void *data;
+
+	const char *strs;
+	uint32_t strs_len;
+
+	/* indexed by type id, entry 0 is the implicit void type. */
+	const struct btf_type **types;
+	uint32_t n_types;
+};
+
+static inline int btf_kind(const struct btf_type *t)
+{
+	return BTF_INFO_KIND(t->info);
+}
+
+static inline int btf_vlen(const struct btf_type *t)
+{
+	return BTF_INFO_VLEN(t->info);
+}
+
+const char *btf_name(struct btf *btf, uint32_t off);
+
+const struct btf_type *btf_type(struct btf *btf, uint32_t id);
+const struct btf_type *btf_resolve(struct btf *btf, uint32_t id);
+
+int32_t btf_find(struct btf *btf, const char *name, int kind);
+
+void btf_free(struct btf *btf);
+struct btf *btf_load(const char *path);
+
+#define BTF_VMLINUX "/sys/kernel/btf/vmlinux"
+
+#endif	/* _PLY_BTF_H */
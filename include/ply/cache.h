@@ -0,0 +1,35 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef _PLY_CACHE_H
+#define _PLY_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* 64-bit FNV-1a */
+#define CACHE_HASH_INIT 0xcbf29ce484222325ULL
+
+static inline uint64_t cache_hash(uint64_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+uint64_t cache_seed(void);
+
+FILE *cache_open(uint64_t key);
+int   cache_put (uint64_t key, int (*write)(FILE *fp, void *priv), void *priv);
+
+void cache_prune(void);
+
+#endif	/* _PLY_CACHE_H */
@@ -0,0 +1,39 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef _PLY_ELFSYMS_H
+#define _PLY_ELFSYMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct elfsym {
+	/* points into the mapped file. */
+	const char *name;
+
+	/* file offset of the function, which is where a uprobe is
+	 * placed. */
+	uint64_t offs;
+};
+
+struct elfsyms {
+	void *map;
+	size_t size;
+
+	/* sorted by name, without duplicates. */
+	struct elfsym *syms;
+	size_t n_syms;
+};
+
+const struct elfsym *elfsyms_get(struct elfsyms *es, const char *name);
+
+void elfsyms_free(struct elfsyms *es);
+struct elfsyms *elfsyms_open(const char *path);
+
+#define elfsyms_foreach(_sym, _es) \
+	for ((_sym) = (_es)->syms; (_sym) < &(_es)->syms[(_es)->n_syms]; (_sym)++)
+
+#endif	/* _PLY_ELFSYMS_H */
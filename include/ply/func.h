@@ -16,6 +16,7 @@ struct func {
 	struct type *type;
 
 	int static_ret:1; 	/* return type is statically known */
+	unsigned ctx:1;		/* returns a pointer to the program context */
 
 	int (*static_validate)(const struct func *, struct node *);
 	int (*type_infer)     (const struct func *, struct node *);
@@ -28,4 +29,9 @@ struct func {
 int func_static_validate(const struct func *func, struct node *n);
 struct type *func_return_type(const struct func *func);
 
+int func_ctx_rewrite(const struct func *func, struct node *n,
+		     struct ply_probe *pb);
+int func_ctx_ir_post(const struct func *func, struct node *n,
+		     struct ply_probe *pb);
+
 #endif	/* _FUNC_H */
@@ -8,6 +8,7 @@
 #define _PLY_INTERNAL_H
 
 #include "arch.h"
+#include "arena.h"
 #include "buffer.h"
 #include "func.h"
 #include "ir.h"
@@ -17,8 +18,12 @@
 #include "type.h"
 
 
+#include "btf.h"
+#include "cache.h"
+#include "elfsyms.h"
 #include "kallsyms.h"
 #include "perf_event.h"
+#include "pool.h"
 #include "printxf.h"
 #include "syscall.h"
 #include "utils.h"
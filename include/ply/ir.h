@@ -51,6 +51,8 @@
 #define ALU64(_op)     INSN(BPF_ALU64 | BPF_OP((_op)) | BPF_X, 0, 0, 0, 0)
 #define ALU64_IMM(_op, _imm) INSN(BPF_ALU64 | BPF_OP((_op)) | BPF_K, 0, 0, 0, _imm)
 
+#define END_TO_BE(_bits) INSN(BPF_ALU | BPF_END | BPF_TO_BE, 0, 0, 0, _bits)
+
 #define STX(_width, _off) INSN(BPF_STX | BPF_SIZE(_width) | BPF_MEM, 0, 0, _off, 0)
 #define ST_IMM(_width, _off, _imm) INSN(BPF_ST | BPF_SIZE(_width) | BPF_MEM, 0, 0, _off, _imm)
 #define ST_XADD(_width, _off) INSN(BPF_STX | BPF_SIZE(_width) | BPF_XADD, 0, 0, _off, 0)
@@ -72,6 +74,13 @@
 
 #define BPF_REG_BP BPF_REG_10
 
+/* holds the address of the per-CPU scratch area, if one is used */
+#define BPF_REG_SCRATCH BPF_REG_9
+
+/* temporaries that do not fit on the stack are moved to a per-CPU
+ * scratch map, which is addressed using 16-bit offsets. */
+#define IR_SCRATCH_MAX INT16_MAX
+
 /* r0 is return value and r1-r5 are used for arguments */
 #define BPF_REG_CALLER_SAVE 0x3f
 
@@ -118,14 +127,51 @@ struct vinsn {
 	};
 };
 
+struct irslot {
+	ssize_t stack;
+	size_t size;
+};
+
+/* Code that may be needed at several places in the same program can
+ * be placed in a subprogram, called using BPF_PSEUDO_CALL. Arguments
+ * are passed in r1-r5 and the result is returned in r0. The body may
+ * only use those registers, and no stack. */
+struct ir;
+
+struct ir_subprog {
+	const char *name;
+	void (*emit)(struct ir *ir);
+};
+
+struct ir_subcall {
+	const struct ir_subprog *sp;
+	int16_t label;
+	unsigned calls;
+};
+
 struct ir {
 	struct vinsn *vi;
-	size_t len;
+	size_t len, size;
 
 	int16_t next_label;
 	uint16_t next_reg;
 
+	/* every stack allocation is recorded so that slots whose
+	 * lifetimes do not overlap can share the same memory once
+	 * the program is complete. after ir_bpf_generate, sp holds
+	 * the final (peak) stack usage. */
+	struct irslot *slots;
+	size_t n_slots;
 	ssize_t sp;
+
+	/* if set, temporaries that do not fit on the stack are
+	 * placed in this map instead, using scratch_size bytes. */
+	struct sym *scratch;
+	size_t scratch_size;
+
+	/* subprograms that are called from this program. */
+	struct ir_subcall *subs;
+	size_t n_subs;
 };
 
 enum irloc {
@@ -153,6 +199,7 @@ struct irstate {
 void insn_dump(struct bpf_insn insn, FILE *fp);
 void vinsn_dump(struct vinsn *vi, FILE *fp);
 void ir_dump(struct ir *ir, FILE *fp);
+void ir_stats_dump(struct ir *ir, FILE *fp);
 
 int16_t ir_alloc_label(struct ir *ir);
 
@@ -185,9 +232,20 @@ void ir_emit_bzero (struct ir *ir, ssize_t offset, size_t size);
 void ir_emit_perf_event_output(struct ir *ir,
 			       struct sym *map, struct sym *regs, struct sym *ev);
 
+void ir_emit_subprog_call(struct ir *ir, const struct ir_subprog *sp);
+
 struct ir *ir_new(void);
+void ir_free(struct ir *ir);
+
+ssize_t ir_bpf_stack_usage(struct ir *ir);
 
 int ir_bpf_generate(struct ir *ir);
 int ir_bpf_extract (struct ir *ir, struct bpf_insn **insnsp, int *n_insnsp);
 
+typedef struct sym *(*ir_sym_fn)(const char *name, void *priv);
+
+uint64_t ir_hash  (struct ir *ir, uint64_t h);
+int      ir_fwrite(struct ir *ir, FILE *fp);
+int      ir_fread (struct ir *ir, FILE *fp, ir_sym_fn sym_fn, void *priv);
+
 #endif	/* _PLY_IR_H */
@@ -57,6 +57,10 @@ struct node {
 	};
 
 	struct nloc loc;
+
+	/* compiler state, see ply_compile */
+	unsigned queued:1;
+	unsigned rewritten:1;
 };
 
 /* debug */
@@ -69,7 +73,7 @@ int node_replace(struct node *n, struct node *new);
 
 
 /* constructors */
-struct node *node_string     (const struct nloc *loc, char *data);
+struct node *node_string     (const struct nloc *loc, const char *data);
 struct node *__node_num      (const struct nloc *loc, size_t size,
 			      int64_t *s64, uint64_t *u64);
 struct node *node_num        (const struct nloc *loc, const char *numstr);
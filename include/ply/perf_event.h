@@ -9,11 +9,25 @@
 
 #define TRACEPATH "/sys/kernel/debug/tracing/"
 
+struct perf_event_attr;
+struct ply;
 struct ply_probe;
 
+void perf_event_register(struct ply *ply, int fd);
+void perf_event_unregister(struct ply *ply, int fd);
+int perf_event_open_bpf(struct ply_probe *pb, struct perf_event_attr *attr,
+			int cpu);
+
 int perf_event_attach(struct ply_probe *pb, const char *name);
 
-int perf_event_enable (int group_fd);
-int perf_event_disable(int group_fd);
+int perf_event_pmu_type(const char *pmu);
+int perf_event_pmu_bit (const char *pmu, const char *format);
+int perf_event_attach_pmu(struct ply_probe *pb, int type, uint64_t config,
+			  const char *name, uint64_t offs);
+int perf_event_attach_cpus(struct ply_probe *pb, struct perf_event_attr *attr,
+			   int **fdsp);
+
+int perf_event_enable (int fd);
+int perf_event_disable(int fd);
 
 #endif	/* _PLY_PERF_EVENT_H */
@@ -9,9 +9,11 @@
 
 #include <stdio.h>
 
+#include "arena.h"
 #include "sym.h"
 #include "utils.h"
 
+struct btf;
 struct ksyms;
 struct ply;
 struct node;
@@ -38,6 +40,17 @@ struct ply_probe {
 
 	struct ir *ir;
 	int bpf_fd;
+
+	/* expected_attach_type of the program, set by the provider
+	 * if it needs something other than the default. */
+	int attach_type;
+
+	/* BTF id of the kernel function that a tracing program is
+	 * attached to. */
+	unsigned attach_btf_id;
+
+	/* number of instructions processed by the kernel verifier. */
+	unsigned verified_insns;
 };
 
 struct ply_config {
@@ -50,20 +63,45 @@ struct ply_config {
 	unsigned hex:1;	    /* prefer hexadecimal output for scalars. */
 	unsigned sort:1;    /* sort maps before output, requires more memory. */
 	unsigned ksyms:1;   /* create ksyms cache. */
+	unsigned cache:1;   /* cache compiled programs on disk. */
 	unsigned strict:1;  /* abort on error. */
 };
 
 extern struct ply_config ply_config;
 
+struct ply_pass {
+	const char *name;
+	uint64_t ns;
+};
+
 struct ply {
+	/* backs all nodes, symbols and ir of this ply. */
+	struct arena arena;
+
 	struct sym *stdbuf;
 
 	struct ply_probe *probes;
 	struct symtab globals;
 	struct ksyms *ksyms;
+	struct btf *btf;
 
 	char *group;
-	int   group_fd;
+
+	/* every perf event opened by the probes, toggled by
+	 * ply_start/ply_stop. */
+	int   *evfds;
+	size_t n_evfds, evfds_size;
+
+	/* set once the probes have been detached, which ply_stop
+	 * does before ply_unload gets to it. */
+	int detached;
+
+	/* held open while program run-time stats are enabled. */
+	int stats_fd;
+
+	/* time spent in each compiler pass, the list is terminated
+	 * by an entry without a name. */
+	struct ply_pass passes[8];
 };
 
 #define ply_probe_foreach(_ply, _probe)					\
@@ -77,13 +115,19 @@ static inline struct ply_probe *sym_to_probe(struct sym *sym)
 	return container_of(sym->st, struct ply_probe, locals);
 }
 
+void ply_map_print(struct sym *sym);
+void ply_map_clear(struct sym *sym);
 void ply_maps_print(struct ply *ply);
 
 struct ply_return ply_loop(struct ply *ply);
 
+int ply_stats_enable(struct ply *ply);
+int ply_probe_runtime(struct ply_probe *pb, uint64_t *ns, uint64_t *cnt);
+
 int ply_start(struct ply *ply);
 int ply_stop(struct ply *ply);
 
+int ply_probe_load(struct ply_probe *pb);
 int ply_load(struct ply *ply);
 int ply_unload(struct ply *ply);
 
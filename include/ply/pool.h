@@ -0,0 +1,19 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef _PLY_POOL_H
+#define _PLY_POOL_H
+
+#include <stddef.h>
+
+/* Calls fn(i, priv) for every i in [0, n), spread across a small pool
+ * of threads. Once an item fails, no new items are started and the
+ * first error is returned. `what` describes the work in progress
+ * reports, e.g. "attaching". */
+int pool_run(const char *what, size_t n,
+	     int (*fn)(size_t i, void *priv), void *priv);
+
+#endif	/* _PLY_POOL_H */
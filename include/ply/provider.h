@@ -23,6 +23,12 @@ struct provider {
 	int (*ir_post)  (struct ply_probe *);
 	int (*attach)   (struct ply_probe *);
 	int (*detach)   (struct ply_probe *);
+
+	/* optional, start is called once all programs are loaded but
+	 * before any probe is attached. stop is called once every
+	 * probe has been detached. */
+	int (*start)    (struct ply_probe *);
+	int (*stop)     (struct ply_probe *);
 };
 
 struct provider *provider_get(const char *name);
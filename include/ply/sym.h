@@ -35,7 +35,12 @@ struct sym {
 
 struct symtab {
 	struct sym **syms;
-	size_t len;
+	size_t len, size;
+
+	/* named symbols are also indexed by an open-addressed hash
+	 * table, syms keeps the allocation order. */
+	struct sym **index;
+	size_t index_len, index_size;
 
 	unsigned global:1;
 };
@@ -43,6 +48,8 @@ struct symtab {
 #define symtab_foreach(_st, _sym) \
 	for((_sym) = (_st)->syms; (_sym) < &(_st)->syms[(_st)->len]; (_sym)++)
 
+struct sym *sym_get(struct symtab *st, const char *name);
+
 struct sym *__sym_alloc(struct symtab *st, const char *name,
 			const struct func *func);
 struct sym *sym_alloc(struct symtab *st, struct node *n,
@@ -17,8 +17,11 @@
 
 extern char bpf_log_buf[LOG_BUF_SIZE];
 
-int bpf_prog_load(enum bpf_prog_type type,
-		  const struct bpf_insn *insns, int insn_cnt);
+int bpf_prog_load(enum bpf_prog_type type, enum bpf_attach_type attach_type,
+		  unsigned attach_btf_id, const struct bpf_insn *insns,
+		  int insn_cnt);
+
+int bpf_prog_get_info(int fd, struct bpf_prog_info *info);
 
 int bpf_map_create(enum bpf_map_type type, int key_sz, int val_sz, int entries);
 
@@ -33,6 +36,27 @@ int bpf_map_next  (int fd, void *key, void *next_key);
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0))
 #define LINUX_HAS_TRACEPOINT
 #endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0))
+#define LINUX_HAS_RAW_TRACEPOINT
+#define LINUX_HAS_EXPECTED_ATTACH_TYPE
+int bpf_raw_tracepoint_open(const char *name, int prog_fd);
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0))
+#define LINUX_HAS_FENTRY
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0))
+#define LINUX_HAS_BPF_STATS
+int bpf_enable_stats(enum bpf_stats_type type);
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0))
+#define LINUX_HAS_RAW_TRACEPOINT_TEST_RUN
+int bpf_prog_test_run(int prog_fd, void *ctx, size_t ctx_size);
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0))
+#define LINUX_HAS_KPROBE_MULTI
+int bpf_link_create(int prog_fd, int target_fd, enum bpf_attach_type type,
+		    union bpf_attr *attr);
+#endif
 
 int perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
 		    int cpu, int group_fd, unsigned long flags);
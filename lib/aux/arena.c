@@ -0,0 +1,108 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ply/ply.h>
+
+#define ARENA_ALIGN      16
+#define ARENA_CHUNK_SIZE 0x10000
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size, used;
+
+	uint8_t data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static struct arena *arena_current;
+
+static struct arena_chunk *arena_grow(struct arena *a, size_t size)
+{
+	struct arena_chunk *c;
+
+	c = xcalloc(1, sizeof(*c) + size);
+	c->size = size;
+
+	/* oversized allocations get a chunk of their own. keep it
+	 * behind the current one, which probably has room left. */
+	if (a->chunks && (size > ARENA_CHUNK_SIZE)) {
+		c->next = a->chunks->next;
+		a->chunks->next = c;
+	} else {
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+
+	return c;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_chunk *c = a->chunks;
+	void *mem;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (!c || (c->size - c->used < size))
+		c = arena_grow(a, size > ARENA_CHUNK_SIZE ?
+			       size : ARENA_CHUNK_SIZE);
+
+	/* chunks are zeroed when allocated and never reused. */
+	mem = &c->data[c->used];
+	c->used += size;
+	return mem;
+}
+
+char *arena_strdup(struct arena *a, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	return memcpy(arena_alloc(a, len), str, len);
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+
+	a->chunks = NULL;
+}
+
+struct arena *arena_enter(struct arena *a)
+{
+	struct arena *prev = arena_current;
+
+	arena_current = a;
+	return prev;
+}
+
+void arena_leave(struct arena *prev)
+{
+	arena_current = prev;
+}
+
+void *acalloc(size_t nmemb, size_t size)
+{
+	assert(arena_current);
+	assert(!size || (nmemb <= SIZE_MAX / size));
+
+	return arena_alloc(arena_current, nmemb * size);
+}
+
+char *astrdup(const char *str)
+{
+	assert(arena_current);
+
+	return arena_strdup(arena_current, str);
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/* Just enough of a BTF reader to find kernel functions and walk their
+ * prototypes. The raw blob is read into memory once and an index
+ * from type id to type record is built on top of it, nothing is
+ * copied or converted.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/version.h>
+
+#include <sys/stat.h>
+
+#include <ply/ply.h>
+#include <ply/btf.h>
+
+const char *btf_name(struct btf *btf, uint32_t off)
+{
+	if (off >= btf->strs_len)
+		return "";
+
+	return btf->strs + off;
+}
+
+const struct btf_type *btf_type(struct btf *btf, uint32_t id)
+{
+	if (!id || id >= btf->n_types)
+		return NULL;
+
+	return btf->types[id];
+}
+
+/* skip over typedefs and qualifiers. */
+const struct btf_type *btf_resolve(struct btf *btf, uint32_t id)
+{
+	const struct btf_type *t;
+
+	while ((t = btf_type(btf, id))) {
+		switch (btf_kind(t)) {
+		case BTF_KIND_TYPEDEF:
+		case BTF_KIND_VOLATILE:
+		case BTF_KIND_CONST:
+		case BTF_KIND_RESTRICT:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+		case BTF_KIND_TYPE_TAG:
+#endif
+			id = t->type;
+			break;
+		default:
+			return t;
+		}
+	}
+
+	return NULL;
+}
+
+int32_t btf_find(struct btf *btf, const char *name, int kind)
+{
+	const struct btf_type *t;
+	uint32_t id;
+
+	for (id = 1; id < btf->n_types; id++) {
+		t = btf->types[id];
+
+		if ((btf_kind(t) == kind)
+		    && !strcmp(btf_name(btf, t->name_off), name))
+			return id;
+	}
+
+	return -ENOENT;
+}
+
+/* size of the kind specific data trailing a type record. */
+static ssize_t btf_type_extra(const struct btf_type *t)
+{
+	switch (btf_kind(t)) {
+	case BTF_KIND_INT:
+		return sizeof(uint32_t);
+	case BTF_KIND_PTR:
+	case BTF_KIND_FWD:
+	case BTF_KIND_TYPEDEF:
+	case BTF_KIND_VOLATILE:
+	case BTF_KIND_CONST:
+	case BTF_KIND_RESTRICT:
+	case BTF_KIND_FUNC:
+		return 0;
+	case BTF_KIND_ARRAY:
+		return sizeof(struct btf_array);
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+		return btf_vlen(t) * sizeof(struct btf_member);
+	case BTF_KIND_ENUM:
+		return btf_vlen(t) * sizeof(struct btf_enum);
+	case BTF_KIND_FUNC_PROTO:
+		return btf_vlen(t) * sizeof(struct btf_param);
+	case BTF_KIND_VAR:
+		return sizeof(struct btf_var);
+	case BTF_KIND_DATASEC:
+		return btf_vlen(t) * sizeof(struct btf_var_secinfo);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+	case BTF_KIND_FLOAT:
+		return 0;
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+	case BTF_KIND_DECL_TAG:
+		return sizeof(struct btf_decl_tag);
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+	case BTF_KIND_TYPE_TAG:
+		return 0;
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	case BTF_KIND_ENUM64:
+		return btf_vlen(t) * sizeof(struct btf_enum64);
+#endif
+	}
+
+	return -EINVAL;
+}
+
+static int btf_index(struct btf *btf, const char *start, const char *end)
+{
+	const struct btf_type *t;
+	const char *p;
+	ssize_t extra;
+	uint32_t id;
+
+	/* the first pass counts the types, the second one records
+	 * where they are. */
+	for (btf->n_types = 1, p = start; p + sizeof(*t) <= end;
+	     btf->n_types++) {
+		t = (const void *)p;
+
+		extra = btf_type_extra(t);
+		if (extra < 0)
+			return extra;
+
+		p += sizeof(*t) + extra;
+	}
+
+	if (p != end)
+		return -EINVAL;
+
+	btf->types = xcalloc(btf->n_types, sizeof(*btf->types));
+
+	for (id = 1, p = start; p < end; id++) {
+		btf->types[id] = t = (const void *)p;
+		p += sizeof(*t) + btf_type_extra(t);
+	}
+
+	return 0;
+}
+
+static int btf_read(struct btf *btf, const char *path, size_t *size)
+{
+	struct stat st;
+	ssize_t len;
+	size_t done;
+	int fd, err = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		goto out;
+	}
+
+	btf->data = xcalloc(1, st.st_size);
+
+	for (done = 0; done < (size_t)st.st_size; done += len) {
+		len = read(fd, btf->data + done, st.st_size - done);
+		if (len <= 0) {
+			err = len ? -errno : -EIO;
+			goto out;
+		}
+	}
+
+	*size = done;
+out:
+	close(fd);
+	return err;
+}
+
+void btf_free(struct btf *btf)
+{
+	free(btf->types);
+	free(btf->data);
+	free(btf);
+}
+
+struct btf *btf_load(const char *path)
+{
+	const struct btf_header *hdr;
+	struct btf *btf;
+	const char *types;
+	size_t size = 0;
+	int err;
+
+	btf = xcalloc(1, sizeof(*btf));
+
+	err = btf_read(btf, path, &size);
+	if (err)
+		goto err;
+
+	err = -EINVAL;
+	hdr = btf->data;
+	if ((size < sizeof(*hdr)) || (hdr->magic != BTF_MAGIC)
+	    || (hdr->hdr_len > size)
+	    || (hdr->hdr_len + hdr->type_off + hdr->type_len > size)
+	    || (hdr->hdr_len + hdr->str_off + hdr->str_len > size))
+		goto err;
+
+	types = btf->data + hdr->hdr_len + hdr->type_off;
+	btf->strs = btf->data + hdr->hdr_len + hdr->str_off;
+	btf->strs_len = hdr->str_len;
+
+	err = btf_index(btf, types, types + hdr->type_len);
+	if (err)
+		goto err;
+
+	_d("%s: %u types\n", path, btf->n_types - 1);
+	return btf;
+err:
+	_d("%s: unable to load: %s\n", path, strerror(-err));
+	btf_free(btf);
+	return NULL;
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/* Stores compiled programs on disk so that subsequent runs of the
+ * same script can skip BPF generation. Entries are named after their
+ * key, which is a hash of everything that the generated code depends
+ * on, so there is never any need to invalidate them. They are however
+ * pruned: entries from other kernels or ply versions can never be hit
+ * again, and the rest are evicted in LRU order once the cache grows
+ * past CACHE_MAX_ENTRIES or CACHE_MAX_SIZE, see cache_prune.
+ *
+ * Since the entries are loaded into the kernel as-is, we refuse to
+ * use a cache directory that anyone but ourselves could have written
+ * to.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include <ply/ply.h>
+#include <ply/cache.h>
+
+#include "../config.h"
+
+#define CACHE_DIR     "/var/tmp/ply-cache"
+#define CACHE_VERSION "2"
+
+#define CACHE_MAX_ENTRIES 0x400
+#define CACHE_MAX_SIZE    (16 << 20)
+
+/* entries are named <seed>-<key>. */
+#define CACHE_NAME_FMT "%016"PRIx64"-%016"PRIx64
+
+uint64_t cache_seed(void)
+{
+	static uint64_t seed;
+	struct utsname uts;
+	uint64_t h = CACHE_HASH_INIT;
+
+	if (seed)
+		return seed;
+
+	h = cache_hash(h, CACHE_VERSION, sizeof(CACHE_VERSION));
+	h = cache_hash(h, PACKAGE_VERSION, sizeof(PACKAGE_VERSION));
+
+	if (!uname(&uts)) {
+		h = cache_hash(h, uts.release, strlen(uts.release));
+		h = cache_hash(h, uts.version, strlen(uts.version));
+		h = cache_hash(h, uts.machine, strlen(uts.machine));
+	}
+
+	seed = h;
+	return h;
+}
+
+static int cache_dir(void)
+{
+	struct stat st;
+
+	if (mkdir(CACHE_DIR, 0700) && (errno != EEXIST))
+		return -errno;
+
+	if (lstat(CACHE_DIR, &st))
+		return -errno;
+
+	if (!S_ISDIR(st.st_mode) || (st.st_uid != geteuid())
+	    || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		_d("ignoring untrusted cache directory " CACHE_DIR "\n");
+		return -EPERM;
+	}
+
+	return 0;
+}
+
+FILE *cache_open(uint64_t key)
+{
+	struct stat st;
+	uint64_t stored;
+	char path[0x40];
+	FILE *fp;
+	int fd;
+
+	if (cache_dir())
+		return NULL;
+
+	snprintf(path, sizeof(path), CACHE_DIR "/" CACHE_NAME_FMT,
+		 cache_seed(), key);
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)
+	    || (st.st_uid != geteuid())) {
+		close(fd);
+		return NULL;
+	}
+
+	fp = fdopen(fd, "r");
+	if (!fp) {
+		close(fd);
+		return NULL;
+	}
+
+	if (!fread(&stored, sizeof(stored), 1, fp) || (stored != key)) {
+		fclose(fp);
+		return NULL;
+	}
+
+	/* the mtime tracks the last use, for eviction. */
+	futimens(fd, NULL);
+	return fp;
+}
+
+struct cache_ent {
+	uint64_t key;
+	time_t mtime;
+	off_t size;
+};
+
+static int cache_ent_cmp(const void *_a, const void *_b)
+{
+	const struct cache_ent *a = _a, *b = _b;
+
+	return (a->mtime > b->mtime) - (a->mtime < b->mtime);
+}
+
+/* set by cache_put, there is nothing to prune unless the cache has
+ * grown. */
+static int cache_dirty;
+
+/* called once per run, rather than after every insertion, since a
+ * single wildcard probe can add hundreds of entries. */
+void cache_prune(void)
+{
+	struct cache_ent *ents = NULL;
+	size_t n = 0, size = 0, i;
+	uint64_t seed, key;
+	off_t total = 0;
+	struct dirent *d;
+	struct stat st;
+	char name[0x28], end;
+	DIR *dir;
+
+	if (!cache_dirty)
+		return;
+
+	cache_dirty = 0;
+	dir = opendir(CACHE_DIR);
+	if (!dir)
+		return;
+
+	while ((d = readdir(dir))) {
+		if (fstatat(dirfd(dir), d->d_name, &st, AT_SYMLINK_NOFOLLOW)
+		    || !S_ISREG(st.st_mode) || (st.st_uid != geteuid()))
+			continue;
+
+		/* temporaries of concurrent writers are left alone. */
+		if (strchr(d->d_name, '.'))
+			continue;
+
+		if ((sscanf(d->d_name, CACHE_NAME_FMT "%c",
+			    &seed, &key, &end) != 2)
+		    || (seed != cache_seed())) {
+			unlinkat(dirfd(dir), d->d_name, 0);
+			continue;
+		}
+
+		if (n == size) {
+			size = size ? size << 1 : 0x40;
+			ents = realloc(ents, size * sizeof(*ents));
+			if (!ents)
+				goto out;
+		}
+
+		ents[n].key = key;
+		ents[n].mtime = st.st_mtime;
+		ents[n].size = st.st_size;
+		total += st.st_size;
+		n++;
+	}
+
+	if ((n <= CACHE_MAX_ENTRIES) && (total <= CACHE_MAX_SIZE))
+		goto out;
+
+	seed = cache_seed();
+	qsort(ents, n, sizeof(*ents), cache_ent_cmp);
+	for (i = 0; (i < n) && ((n - i > CACHE_MAX_ENTRIES)
+				|| (total > CACHE_MAX_SIZE)); i++) {
+		snprintf(name, sizeof(name), CACHE_NAME_FMT,
+			 seed, ents[i].key);
+		unlinkat(dirfd(dir), name, 0);
+		total -= ents[i].size;
+	}
+
+out:
+	free(ents);
+	closedir(dir);
+}
+
+int cache_put(uint64_t key, int (*write)(FILE *fp, void *priv), void *priv)
+{
+	char path[0x40], tmp[0x48];
+	FILE *fp;
+	int err, fd;
+
+	err = cache_dir();
+	if (err)
+		return err;
+
+	snprintf(path, sizeof(path), CACHE_DIR "/" CACHE_NAME_FMT,
+		 cache_seed(), key);
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+	/* write to a temporary file and rename it in place once
+	 * complete, that way concurrent readers will never see a
+	 * partial entry. */
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		err = -errno;
+		close(fd);
+		goto err_unlink;
+	}
+
+	err = fwrite(&key, sizeof(key), 1, fp) ? 0 : -EIO;
+	err = err ? : write(fp, priv);
+	if (fclose(fp) && !err)
+		err = -EIO;
+	if (err)
+		goto err_unlink;
+
+	if (rename(tmp, path)) {
+		err = -errno;
+		goto err_unlink;
+	}
+
+	cache_dirty = 1;
+	return 0;
+
+err_unlink:
+	unlink(tmp);
+	return err;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/* Function symbols of a userspace binary, used to place uprobes. The
+ * file is mapped and .symtab/.dynsym are walked once, recording the
+ * file offset of every defined function. Names are not copied, they
+ * point straight into the mapping, which is why it is kept around
+ * for as long as the symbols are in use.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ply/ply.h>
+#include <ply/elfsyms.h>
+
+/* only binaries of the host's word size can be probed. */
+#if __ELF_NATIVE_CLASS == 64
+#define ELFCLASS_NATIVE ELFCLASS64
+#else
+#define ELFCLASS_NATIVE ELFCLASS32
+#endif
+
+static int elfsym_cmp(const void *_a, const void *_b)
+{
+	const struct elfsym *a = _a, *b = _b;
+
+	return strcmp(a->name, b->name);
+}
+
+static int elfsym_key_cmp(const void *key, const void *_member)
+{
+	const struct elfsym *member = _member;
+
+	return strcmp(key, member->name);
+}
+
+const struct elfsym *elfsyms_get(struct elfsyms *es, const char *name)
+{
+	return bsearch(name, es->syms, es->n_syms, sizeof(*es->syms),
+		       elfsym_key_cmp);
+}
+
+/* symbols hold virtual addresses, uprobes want file offsets. */
+static int elfsyms_offset(const ElfW(Ehdr) *eh, ElfW(Addr) addr,
+			  uint64_t *offs)
+{
+	const ElfW(Phdr) *ph = (const void *)eh + eh->e_phoff;
+	int i;
+
+	for (i = 0; i < eh->e_phnum; i++, ph++) {
+		if ((ph->p_type != PT_LOAD) || !(ph->p_flags & PF_X))
+			continue;
+
+		if ((addr >= ph->p_vaddr)
+		    && (addr < (ph->p_vaddr + ph->p_filesz))) {
+			*offs = addr - ph->p_vaddr + ph->p_offset;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static void elfsyms_scan(struct elfsyms *es, const ElfW(Shdr) *sh,
+			 size_t *size)
+{
+	const ElfW(Ehdr) *eh = es->map;
+	const ElfW(Shdr) *strsh;
+	const ElfW(Sym) *sym, *end;
+	const char *strs;
+	uint64_t offs;
+
+	if ((sh->sh_link >= eh->e_shnum) || !sh->sh_entsize
+	    || (sh->sh_offset + sh->sh_size > es->size))
+		return;
+
+	strsh = (const void *)eh + eh->e_shoff + sh->sh_link * eh->e_shentsize;
+	if (strsh->sh_offset + strsh->sh_size > es->size)
+		return;
+
+	strs = es->map + strsh->sh_offset;
+
+	sym = es->map + sh->sh_offset;
+	end = (const void *)sym + sh->sh_size;
+	for (; sym < end; sym++) {
+		if ((ELF64_ST_TYPE(sym->st_info) != STT_FUNC)
+		    || (sym->st_shndx == SHN_UNDEF) || !sym->st_value
+		    || (sym->st_name >= strsh->sh_size))
+			continue;
+
+		if (elfsyms_offset(eh, sym->st_value, &offs))
+			continue;
+
+		if (es->n_syms == *size) {
+			*size = *size ? *size << 1 : 0x100;
+			es->syms = realloc(es->syms, *size * sizeof(*es->syms));
+			assert(es->syms);
+		}
+
+		es->syms[es->n_syms++] = (struct elfsym) {
+			.name = strs + sym->st_name,
+			.offs = offs,
+		};
+	}
+}
+
+static int elfsyms_index(struct elfsyms *es)
+{
+	const ElfW(Ehdr) *eh = es->map;
+	const ElfW(Shdr) *sh;
+	size_t size = 0, i, n;
+
+	if ((es->size < sizeof(*eh)) || memcmp(eh->e_ident, ELFMAG, SELFMAG)
+	    || (eh->e_ident[EI_CLASS] != ELFCLASS_NATIVE)
+	    || (eh->e_shoff + eh->e_shnum * eh->e_shentsize > es->size)
+	    || (eh->e_phoff + eh->e_phnum * eh->e_phentsize > es->size))
+		return -ENOEXEC;
+
+	/* a stripped binary might only have .dynsym, an unstripped
+	 * one has both. duplicates are removed below. */
+	for (i = 0; i < eh->e_shnum; i++) {
+		sh = (const void *)eh + eh->e_shoff + i * eh->e_shentsize;
+
+		if ((sh->sh_type == SHT_SYMTAB) || (sh->sh_type == SHT_DYNSYM))
+			elfsyms_scan(es, sh, &size);
+	}
+
+	if (!es->n_syms)
+		return 0;
+
+	qsort(es->syms, es->n_syms, sizeof(*es->syms), elfsym_cmp);
+	for (i = 1, n = 1; i < es->n_syms; i++) {
+		if (strcmp(es->syms[i].name, es->syms[n - 1].name))
+			es->syms[n++] = es->syms[i];
+	}
+	es->n_syms = n;
+	return 0;
+}
+
+void elfsyms_free(struct elfsyms *es)
+{
+	if (es->map)
+		munmap(es->map, es->size);
+
+	free(es->syms);
+	free(es);
+}
+
+struct elfsyms *elfsyms_open(const char *path)
+{
+	struct elfsyms *es;
+	struct stat st;
+	int fd, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	es = xcalloc(1, sizeof(*es));
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		goto err;
+	}
+
+	es->size = st.st_size;
+	es->map = mmap(NULL, es->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (es->map == MAP_FAILED) {
+		es->map = NULL;
+		err = -errno;
+		goto err;
+	}
+
+	err = elfsyms_index(es);
+	if (err)
+		goto err;
+
+	close(fd);
+	_d("%s: %zu functions\n", path, es->n_syms);
+	return es;
+err:
+	_d("%s: unable to read symbols: %s\n", path, strerror(-err));
+	close(fd);
+	elfsyms_free(es);
+	return NULL;
+}
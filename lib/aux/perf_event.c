@@ -4,8 +4,11 @@
  * SPDX-License-Identifier: GPL-2.0
  */
 
+#include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include <linux/perf_event.h>
@@ -16,6 +19,46 @@
 #include <ply/ply.h>
 #include <ply/internal.h>
 
+/* probes are attached in parallel, see xprobe_attach_all. */
+static pthread_mutex_t perf_event_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* record an event that ply_start/ply_stop should toggle. events are
+ * opened disabled, nothing is counted or sampled until the ply is
+ * started. */
+void perf_event_register(struct ply *ply, int fd)
+{
+	pthread_mutex_lock(&perf_event_lock);
+
+	if (ply->n_evfds == ply->evfds_size) {
+		ply->evfds_size = ply->evfds_size ? ply->evfds_size << 1 : 0x10;
+		ply->evfds = realloc(ply->evfds,
+				     ply->evfds_size * sizeof(*ply->evfds));
+		assert(ply->evfds);
+	}
+
+	ply->evfds[ply->n_evfds++] = fd;
+
+	pthread_mutex_unlock(&perf_event_lock);
+}
+
+/* must be called before the event is closed, or ply_start/ply_stop
+ * could end up operating on a reused fd. */
+void perf_event_unregister(struct ply *ply, int fd)
+{
+	size_t i;
+
+	pthread_mutex_lock(&perf_event_lock);
+
+	for (i = 0; i < ply->n_evfds; i++) {
+		if (ply->evfds[i] == fd) {
+			ply->evfds[i] = ply->evfds[--ply->n_evfds];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&perf_event_lock);
+}
+
 static int perf_event_id(struct ply_probe *pb, const char *path)
 {
 	FILE *fp;
@@ -23,20 +66,46 @@ static int perf_event_id(struct ply_probe *pb, const char *path)
 
 	fp = fopenf("r", "%s/id", path);
 	if (!fp)
-		goto err;
+		return -errno;
 
 	if (fscanf(fp, "%d", &id) != 1)
-		goto err;
+		id = -EINVAL;
 
+	fclose(fp);
 	return id;
-err:
-	return -errno;
 }
 
+/* open an event on `cpu` that runs pb's program on every hit. */
+int perf_event_open_bpf(struct ply_probe *pb, struct perf_event_attr *attr,
+			int cpu)
+{
+	int fd;
+
+	fd = perf_event_open(attr, -1, cpu, -1, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (ioctl(fd, PERF_EVENT_IOC_SET_BPF, pb->bpf_fd)) {
+		close(fd);
+		return -errno;
+	}
+
+	perf_event_register(pb->ply, fd);
+	return fd;
+}
+
+/* The perf API requires a cpu for system wide events, but for
+ * tracepoints (and k/uprobes) the program is attached to the
+ * tracepoint itself, not to the event. It therefore runs on every
+ * cpu, no matter which one the event is bound to. Opening one event
+ * per cpu would not add any coverage, the kernel would refuse to
+ * attach the same program to the same tracepoint again. Events bound
+ * to an offline cpu do keep the program attached, so cpu 0 is as
+ * good as any. */
 int perf_event_attach(struct ply_probe *pb, const char *path)
 {
 	struct perf_event_attr attr = {};
-	int fd, id;
+	int id;
 
 	id = perf_event_id(pb, path);
 	if (id < 0)
@@ -46,39 +115,125 @@ int perf_event_attach(struct ply_probe *pb, const char *path)
 	attr.sample_type = PERF_SAMPLE_RAW;
 	attr.sample_period = 1;
 	attr.wakeup_events = 1;
+	attr.disabled = 1;
 	attr.config = id;
 
-	fd = perf_event_open(&attr, -1, 0, pb->ply->group_fd, 0);
-	if (fd < 0)
+	return perf_event_open_bpf(pb, &attr, 0);
+}
+
+#define PMUPATH "/sys/bus/event_source/devices/"
+
+int perf_event_pmu_type(const char *pmu)
+{
+	FILE *fp;
+	int type;
+
+	fp = fopenf("r", PMUPATH "%s/type", pmu);
+	if (!fp)
 		return -errno;
 
-	/* if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0)) { */
-	/* 	close(fd); */
-	/* 	return -errno; */
-	/* } */
+	if (fscanf(fp, "%d", &type) != 1)
+		type = -EINVAL;
 
-	if (ioctl(fd, PERF_EVENT_IOC_SET_BPF, pb->bpf_fd)) {
-		close(fd);
+	fclose(fp);
+	return type;
+}
+
+/* format files describe where a flag lives in the attr, e.g. the
+ * retprobe flag of the kprobe pmu is "config:0". */
+int perf_event_pmu_bit(const char *pmu, const char *format)
+{
+	FILE *fp;
+	int bit;
+
+	fp = fopenf("r", PMUPATH "%s/format/%s", pmu, format);
+	if (!fp)
 		return -errno;
+
+	if (fscanf(fp, "config:%d", &bit) != 1)
+		bit = -EINVAL;
+
+	fclose(fp);
+	return bit;
+}
+
+/* Since 4.17, k- and uprobes can be created by opening an event on
+ * the corresponding dynamic pmu. The probe then lives exactly as long
+ * as the fd, without any round trips through tracefs. `name` is the
+ * function (kprobe) or path (uprobe), `offs` the offset from it. */
+int perf_event_attach_pmu(struct ply_probe *pb, int type, uint64_t config,
+			  const char *name, uint64_t offs)
+{
+	struct perf_event_attr attr = {};
+
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.sample_type = PERF_SAMPLE_RAW;
+	attr.sample_period = 1;
+	attr.wakeup_events = 1;
+	attr.disabled = 1;
+	attr.config  = config;
+	attr.config1 = (uintptr_t)name;
+	attr.config2 = offs;
+
+	return perf_event_open_bpf(pb, &attr, 0);
+}
+
+/* Sampling events, e.g. timers or software counters, on the other
+ * hand only fire on the cpu they are bound to. One event is opened on
+ * every online cpu, each running pb's program on overflow. Returns
+ * the number of events, whose fds are stored in `fdsp`. */
+int perf_event_attach_cpus(struct ply_probe *pb, struct perf_event_attr *attr,
+			   int **fdsp)
+{
+	int cpu, ncpus, n = 0, *fds, err;
+
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (ncpus < 1)
+		return -EINVAL;
+
+	fds = xcalloc(ncpus, sizeof(*fds));
+
+	attr->disabled = 1;
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		fds[n] = perf_event_open_bpf(pb, attr, cpu);
+		if (fds[n] < 0) {
+			/* offline cpus are skipped. */
+			if (fds[n] == -ENODEV)
+				continue;
+
+			err = fds[n];
+			goto err_close;
+		}
+
+		n++;
 	}
 
-	if (pb->ply->group_fd == -1)
-		pb->ply->group_fd = fd;
+	*fdsp = fds;
+	return n;
 
-	return fd;
+err_close:
+	while (n--) {
+		perf_event_unregister(pb->ply, fds[n]);
+		close(fds[n]);
+	}
+
+	free(fds);
+	return err;
 }
 
-int perf_event_enable(int group_fd)
+int perf_event_enable(int fd)
 {
-	if (ioctl(group_fd, PERF_EVENT_IOC_ENABLE, 0))
+	if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0))
 		return -errno;
 
 	return 0;
 }
 
-int perf_event_disable(int group_fd)
+int perf_event_disable(int fd)
 {
-	if (ioctl(group_fd, PERF_EVENT_IOC_DISABLE, 0))
+	if (ioctl(fd, PERF_EVENT_IOC_DISABLE, 0))
 		return -errno;
 
 	return 0;
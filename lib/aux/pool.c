@@ -0,0 +1,125 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ply/ply.h>
+#include <ply/pool.h>
+
+#define POOL_MAX_THREADS 8
+
+/* below this, threads are not worth the trouble and there is no
+ * point in reporting progress. */
+#define POOL_MIN_ITEMS 0x40
+
+struct pool {
+	const char *what;
+	size_t n;
+	int (*fn)(size_t i, void *priv);
+	void *priv;
+
+	size_t next, done;
+	int err;
+	int progress;
+};
+
+static void pool_progress(struct pool *p, size_t done)
+{
+	/* report every percent, at most. */
+	if (!p->progress || ((done * 100 / p->n) == ((done - 1) * 100 / p->n)))
+		return;
+
+	fprintf(stderr, "\r%s: %zu/%zu", p->what, done, p->n);
+}
+
+static void *pool_worker(void *_p)
+{
+	struct pool *p = _p;
+	size_t i, done;
+	int err;
+
+	for (;;) {
+		if (__atomic_load_n(&p->err, __ATOMIC_RELAXED))
+			break;
+
+		i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED);
+		if (i >= p->n)
+			break;
+
+		err = p->fn(i, p->priv);
+		if (err) {
+			__atomic_compare_exchange_n(&p->err, &(int){ 0 }, err, 0,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED);
+			break;
+		}
+
+		done = __atomic_add_fetch(&p->done, 1, __ATOMIC_RELAXED);
+		pool_progress(p, done);
+	}
+
+	return NULL;
+}
+
+static uint64_t pool_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int pool_run(const char *what, size_t n,
+	     int (*fn)(size_t i, void *priv), void *priv)
+{
+	struct pool p = {
+		.what = what,
+		.n = n,
+		.fn = fn,
+		.priv = priv,
+	};
+	pthread_t threads[POOL_MAX_THREADS - 1];
+	long ncpus;
+	int i, n_threads = 0;
+	uint64_t start;
+
+	if (n < POOL_MIN_ITEMS) {
+		pool_worker(&p);
+		return p.err;
+	}
+
+	p.progress = isatty(STDERR_FILENO);
+	start = pool_now_ms();
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > POOL_MAX_THREADS)
+		ncpus = POOL_MAX_THREADS;
+
+	/* the calling thread is part of the pool too. */
+	for (i = 0; i < ncpus - 1; i++) {
+		if (pthread_create(&threads[n_threads], NULL, pool_worker, &p))
+			break;
+
+		n_threads++;
+	}
+
+	pool_worker(&p);
+
+	for (i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (p.progress)
+		fprintf(stderr, ", %"PRIu64" ms\n", pool_now_ms() - start);
+
+	_d("%s: %zu/%zu on %d threads in %"PRIu64" ms\n", what,
+	   p.done, n, n_threads + 1, pool_now_ms() - start);
+	return p.err;
+}
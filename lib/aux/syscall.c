@@ -23,8 +23,9 @@ static __u64 ptr_to_u64(const void *ptr)
         return (__u64) (unsigned long) ptr;
 }
 
-int bpf_prog_load(enum bpf_prog_type type,
-		  const struct bpf_insn *insns, int insn_cnt)
+int bpf_prog_load(enum bpf_prog_type type, enum bpf_attach_type attach_type,
+		  unsigned attach_btf_id, const struct bpf_insn *insns,
+		  int insn_cnt)
 {
 	union bpf_attr attr;
 
@@ -34,6 +35,12 @@ int bpf_prog_load(enum bpf_prog_type type,
 
 	attr.kern_version = LINUX_VERSION_CODE;
 	attr.prog_type    = type;
+#ifdef LINUX_HAS_EXPECTED_ATTACH_TYPE
+	attr.expected_attach_type = attach_type;
+#endif
+#ifdef LINUX_HAS_FENTRY
+	attr.attach_btf_id = attach_btf_id;
+#endif
 	attr.insns        = ptr_to_u64(insns);
 	attr.insn_cnt     = insn_cnt;
 	attr.license      = ptr_to_u64("GPL");
@@ -44,6 +51,73 @@ int bpf_prog_load(enum bpf_prog_type type,
 	return syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
 }
 
+#ifdef LINUX_HAS_KPROBE_MULTI
+/* `attr` may carry attach type specific options, the common fields
+ * are filled in here. */
+int bpf_link_create(int prog_fd, int target_fd, enum bpf_attach_type type,
+		    union bpf_attr *attr)
+{
+	attr->link_create.prog_fd     = prog_fd;
+	attr->link_create.target_fd   = target_fd;
+	attr->link_create.attach_type = type;
+
+	return syscall(__NR_bpf, BPF_LINK_CREATE, attr, sizeof(*attr));
+}
+#endif
+
+#ifdef LINUX_HAS_RAW_TRACEPOINT
+int bpf_raw_tracepoint_open(const char *name, int prog_fd)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.raw_tracepoint.name    = ptr_to_u64(name);
+	attr.raw_tracepoint.prog_fd = prog_fd;
+
+	return syscall(__NR_bpf, BPF_RAW_TRACEPOINT_OPEN, &attr, sizeof(attr));
+}
+#endif
+
+#ifdef LINUX_HAS_BPF_STATS
+int bpf_enable_stats(enum bpf_stats_type type)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.enable_stats.type = type;
+
+	return syscall(__NR_bpf, BPF_ENABLE_STATS, &attr, sizeof(attr));
+}
+#endif
+
+#ifdef LINUX_HAS_RAW_TRACEPOINT_TEST_RUN
+int bpf_prog_test_run(int prog_fd, void *ctx, size_t ctx_size)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.test.prog_fd     = prog_fd;
+	attr.test.ctx_in      = ptr_to_u64(ctx);
+	attr.test.ctx_size_in = ctx_size;
+
+	return syscall(__NR_bpf, BPF_PROG_TEST_RUN, &attr, sizeof(attr));
+}
+#endif
+
+int bpf_prog_get_info(int fd, struct bpf_prog_info *info)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	memset(info, 0, sizeof(*info));
+
+	attr.info.bpf_fd   = fd;
+	attr.info.info_len = sizeof(*info);
+	attr.info.info     = ptr_to_u64(info);
+
+	return syscall(__NR_bpf, BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof(attr));
+}
+
 int bpf_map_create(enum bpf_map_type type, int key_sz, int val_sz, int entries)
 {
 	union bpf_attr attr;
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <ply/ply.h>
@@ -31,6 +32,7 @@ static void strkill(char *str, char kill)
 int strtonum(const char *_str, int64_t *s64, uint64_t *u64)
 {
 	char *str = strdup(_str);
+	int ret = 0;
 
 	strkill(str, '_');
 
@@ -38,18 +40,19 @@ int strtonum(const char *_str, int64_t *s64, uint64_t *u64)
 	if (*str == '-') {
 		*s64 = strtoll(str, NULL, 0);
 		if (!errno)
-			return -1;
+			ret = -1;
 	} else if (strstr(str, "0b") == str) {
 		*u64 = strtoull(&str[2], NULL, 2);
 		if (!errno)
-			return 1;
+			ret = 1;
 	} else {
 		*u64 = strtoull(str, NULL, 0);
 		if (!errno)
-			return 1;
+			ret = 1;
 	}
 
-	return 0;
+	free(str);
+	return ret;
 }
 
 int isstring(const char *data, size_t len)
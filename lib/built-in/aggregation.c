@@ -211,6 +211,52 @@ static int quantize_fprint(struct type *t, FILE *fp, const void *data)
 	return 0;
 }
 
+/* r0: bucket number
+   r1: arg
+   r2: arg copy, for 64-bit log2 operation
+*/
+static void __quantize_log2_emit(struct ir *ir, int wide)
+{
+	int i;
+
+	ir_emit_insn(ir, MOV_IMM(0), BPF_REG_0, 0);
+
+	if (wide) {
+		ir_emit_insn(ir, MOV64, BPF_REG_2, BPF_REG_1);
+		ir_emit_insn(ir, ALU64_IMM(BPF_RSH, 32), BPF_REG_2, 0);
+		ir_emit_insn(ir, JMP_IMM(BPF_JEQ, 0, 2), BPF_REG_2, 0);
+		ir_emit_insn(ir, ALU_IMM(BPF_ADD, 32), BPF_REG_0, 0);
+		ir_emit_insn(ir, MOV64, BPF_REG_1, BPF_REG_2);
+	}
+
+	for (i = 16; i; i >>= 1) {
+		ir_emit_insn(ir, JMP_IMM(BPF_JLE, ((1 << i) - 1), 2), BPF_REG_1, 0);
+		ir_emit_insn(ir, ALU_IMM(BPF_ADD, i), BPF_REG_0, 0);
+		ir_emit_insn(ir, ALU64_IMM(BPF_RSH, i), BPF_REG_1, 0);
+	}
+}
+
+static void quantize_log2_emit(struct ir *ir)
+{
+	__quantize_log2_emit(ir, 0);
+}
+
+static void quantize_log2_wide_emit(struct ir *ir)
+{
+	__quantize_log2_emit(ir, 1);
+}
+
+/* shared by all quantize() calls in a probe. */
+static const struct ir_subprog quantize_log2 = {
+	.name = "log2",
+	.emit = quantize_log2_emit,
+};
+
+static const struct ir_subprog quantize_log2_wide = {
+	.name = "log2_64",
+	.emit = quantize_log2_wide_emit,
+};
+
 static int quantize_ir_post(const struct func *func, struct node *n,
 			    struct ply_probe *pb)
 {
@@ -218,28 +264,11 @@ static int quantize_ir_post(const struct func *func, struct node *n,
 	struct node *arg = n->expr.args;
 	struct type *atype = type_base(n->sym->type)->array.type;
 	size_t bucketsz = type_sizeof(atype);
-	int i;
-
-	/* r0: bucket number
-	   r1: arg
-	   r2: arg copy, for 64-bit log2 operation
-	 */
-	ir_emit_insn(pb->ir, MOV_IMM(0), BPF_REG_0, 0);
 
 	ir_emit_sym_to_reg(pb->ir, BPF_REG_1, arg->sym);
-	if (type_sizeof(type_return(arg->sym->type)) > 4) {
-		ir_emit_insn(pb->ir, MOV64, BPF_REG_2, BPF_REG_1);
-		ir_emit_insn(pb->ir, ALU64_IMM(BPF_RSH, 32), BPF_REG_2, 0);
-		ir_emit_insn(pb->ir, JMP_IMM(BPF_JEQ, 0, 2), BPF_REG_2, 0);
-		ir_emit_insn(pb->ir, ALU_IMM(BPF_ADD, 32), BPF_REG_0, 0);
-		ir_emit_insn(pb->ir, MOV64, BPF_REG_1, BPF_REG_2);
-	}
-
-	for (i = 16; i; i >>= 1) {
-		ir_emit_insn(pb->ir, JMP_IMM(BPF_JLE, ((1 << i) - 1), 2), BPF_REG_1, 0);
-		ir_emit_insn(pb->ir, ALU_IMM(BPF_ADD, i), BPF_REG_0, 0);
-		ir_emit_insn(pb->ir, ALU64_IMM(BPF_RSH, i), BPF_REG_1, 0);
-	}
+	ir_emit_subprog_call(pb->ir,
+			     type_sizeof(type_return(arg->sym->type)) > 4 ?
+			     &quantize_log2_wide : &quantize_log2);
 
 	/* bucket in r0, convert it to an offset in the array */
 	switch (bucketsz) {
@@ -184,6 +184,21 @@ struct ply_return buffer_loop(struct buffer *buf)
 	return ret;
 }
 
+/* handle whatever is queued, without waiting for more. */
+struct ply_return buffer_drain(struct buffer *buf)
+{
+	struct ply_return ret = {};
+	uint32_t cpu;
+
+	for (cpu = 0; cpu < buf->ncpus; cpu++) {
+		ret = buffer_q_drain(&buf->q[cpu]);
+		if (ret.err | ret.exit)
+			break;
+	}
+
+	return ret;
+}
+
 int buffer_q_init(struct buffer *buf, uint32_t cpu)
 {
 	struct perf_event_attr attr = { 0 };
@@ -138,7 +138,7 @@ static const struct func string_func = {
 };
 
 
-static const struct func ident_func = {
+const struct func ident_func = {
 	.name = ":ident",
 };
 
@@ -150,17 +150,60 @@ __ply_built_in const struct func block_func = {
 };
 
 
-static const struct func *built_in_func_get(struct node *n)
+/* built-ins sorted by name, so that lookups can bsearch. */
+static const struct func **built_in_index;
+static size_t built_in_len;
+
+static int built_in_cmp(const void *_a, const void *_b)
+{
+	const struct func * const *a = _a, * const *b = _b;
+	int cmp;
+
+	cmp = strcmp((*a)->name, (*b)->name);
+	if (cmp)
+		return cmp;
+
+	/* keep section order among duplicates, the first one wins. */
+	return (*a < *b) ? -1 : (*a > *b);
+}
+
+static int built_in_key_cmp(const void *key, const void *_f)
+{
+	const struct func * const *f = _f;
+
+	return strcmp(key, (*f)->name);
+}
+
+__attribute__((constructor))
+static void built_in_index_init(void)
 {
 	const struct func *func;
-	int err;
 
-	for (func = &__start_built_ins; func < &__stop_built_ins; func++) {
-		if (!strcmp(func->name, n->expr.func))
-			return func;
-	}
+	built_in_len = &__stop_built_ins - &__start_built_ins;
+	built_in_index = xcalloc(built_in_len, sizeof(*built_in_index));
 
-	return NULL;
+	for (func = &__start_built_ins; func < &__stop_built_ins; func++)
+		built_in_index[func - &__start_built_ins] = func;
+
+	qsort(built_in_index, built_in_len, sizeof(*built_in_index),
+	      built_in_cmp);
+}
+
+static const struct func *built_in_func_get(struct node *n)
+{
+	const struct func **func;
+
+	func = bsearch(n->expr.func, built_in_index, built_in_len,
+		       sizeof(*built_in_index), built_in_key_cmp);
+	if (!func)
+		return NULL;
+
+	/* bsearch may land on any of a run of duplicates. */
+	while ((func > built_in_index)
+	       && !strcmp(func[-1]->name, (*func)->name))
+		func--;
+
+	return *func;
 }
 
 static int built_in_sym_alloc(struct ply_probe *pb, struct node *n)
@@ -15,4 +15,7 @@
 extern const struct func __start_built_ins;
 extern const struct func __stop_built_ins;
 
+/* identifiers that are not built-ins, i.e. user defined maps. */
+extern const struct func ident_func;
+
 #endif	/* _PLY_BUILT_IN_H */
@@ -109,9 +109,8 @@ static int if_type_infer(const struct func *func, struct node *n)
 {
 	struct node *expr = n->expr.args;
 
-	/* TODO: leaked */
 	if (!n->sym->priv)
-		n->sym->priv = xcalloc(1, sizeof(struct if_priv));
+		n->sym->priv = acalloc(1, sizeof(struct if_priv));
 
 	if (!expr->sym->type)
 		return 0;
@@ -7,19 +7,46 @@
 #define _GNU_SOURCE 		/* asprintf */
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 
 #include <ply/ply.h>
 #include <ply/internal.h>
 
 #include "built-in.h"
 
-static void strcmp_emit(struct ir *ir, uint16_t dst,
-			ssize_t a, ssize_t b, const char *blit, size_t len)
+/* Strings are compared a word at a time whenever their positions on
+ * the stack allow it. The word-wise paths only produce the sign of
+ * the result, which is all that strcmp(3) promises anyway. */
+
+static int strcmp_width(size_t width)
 {
-	int16_t done;
-	int literal = blit ? 1 : 0;
+	switch (width) {
+	case 8: return BPF_DW;
+	case 4: return BPF_W;
+	case 2: return BPF_H;
+	}
 
-	done = ir_alloc_label(ir);
+	return BPF_B;
+}
+
+/* jumped to with one chunk from each string in dst and r1,
+ * respectively, both in big-endian order, that are not equal. */
+static void strcmp_emit_order(struct ir *ir, uint16_t dst, int16_t done)
+{
+	int16_t gt = ir_alloc_label(ir);
+
+	ir_emit_insn(ir, JMP(BPF_JGT, gt), dst, BPF_REG_1);
+	ir_emit_insn(ir, MOV_IMM(-1), dst, 0);
+	ir_emit_insn(ir, JMP_IMM(BPF_JA, 0, done), 0, 0);
+	ir_emit_label(ir, gt);
+	ir_emit_insn(ir, MOV_IMM(1), dst, 0);
+}
+
+static void strcmp_emit_bytes(struct ir *ir, uint16_t dst, ssize_t a,
+			      ssize_t b, const char *blit, size_t len,
+			      int16_t done)
+{
+	int literal = blit ? 1 : 0;
 
 	for (; len; len--, a++, b++, blit++) {
 		ir_emit_insn(ir, LDX(BPF_B, a), dst, BPF_REG_BP);
@@ -41,6 +68,119 @@ static void strcmp_emit(struct ir *ir, uint16_t dst,
 
 		ir_emit_insn(ir, JMP_IMM(BPF_JNE, 0, done), dst, 0);
 	}
+}
+
+static void strcmp_emit_literal(struct ir *ir, uint16_t dst, ssize_t a,
+				const char *blit, size_t len, int16_t done)
+{
+	int16_t ne = ir_alloc_label(ir);
+	uint64_t imm;
+	size_t width, i;
+
+	/* nothing past the literal's terminator has to be looked
+	 * at. */
+	len = min(len, strlen(blit) + 1);
+
+	for (; len; len -= width, a += width, blit += width) {
+		for (width = 8; (width > len) || (a & (width - 1)); width >>= 1);
+
+		/* both sides in big-endian order, so that the first
+		 * differing character decides which one is larger. */
+		for (imm = 0, i = 0; i < width; i++)
+			imm = (imm << 8) | (uint8_t)blit[i];
+
+		ir_emit_insn(ir, LDX(strcmp_width(width), a), dst, BPF_REG_BP);
+		if (width > 1)
+			ir_emit_insn(ir, END_TO_BE(width * 8), dst, 0);
+
+		if (width == 8) {
+			ir_emit_insn(ir, LDDW_IMM((uint32_t)imm), BPF_REG_1, 0);
+			ir_emit_insn(ir, INSN(0, 0, 0, 0, imm >> 32), 0, 0);
+		} else {
+			/* zero-extended, like the load */
+			ir_emit_insn(ir, MOV32_IMM((int32_t)imm), BPF_REG_1, 0);
+		}
+
+		ir_emit_insn(ir, JMP(BPF_JNE, ne), dst, BPF_REG_1);
+	}
+
+	ir_emit_insn(ir, MOV_IMM(0), dst, 0);
+	ir_emit_insn(ir, JMP_IMM(BPF_JA, 0, done), 0, 0);
+
+	ir_emit_label(ir, ne);
+	strcmp_emit_order(ir, dst, done);
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static void strcmp_emit_words(struct ir *ir, uint16_t dst, ssize_t a,
+			      ssize_t b, size_t len, int16_t done)
+{
+	int16_t nul = ir_alloc_label(ir), ne = ir_alloc_label(ir);
+
+	/* r3 = 0x0101..01, r4 = 0x8080..80 */
+	ir_emit_insn(ir, LDDW_IMM(0x01010101), BPF_REG_3, 0);
+	ir_emit_insn(ir, INSN(0, 0, 0, 0, 0x01010101), 0, 0);
+	ir_emit_insn(ir, MOV64, BPF_REG_4, BPF_REG_3);
+	ir_emit_insn(ir, ALU64_IMM(BPF_LSH, 7), BPF_REG_4, 0);
+
+	for (; len >= 8; len -= 8, a += 8, b += 8) {
+		ir_emit_insn(ir, LDX(BPF_DW, a), dst, BPF_REG_BP);
+		ir_emit_insn(ir, LDX(BPF_DW, b), BPF_REG_1, BPF_REG_BP);
+
+		/* r2 = (dst - r3) & ~dst & r4, which is non-zero if
+		 * dst contains a NUL. the lowest set bit is exact,
+		 * false positives only appear above it. */
+		ir_emit_insn(ir, MOV64, BPF_REG_2, dst);
+		ir_emit_insn(ir, ALU64(BPF_SUB), BPF_REG_2, BPF_REG_3);
+		ir_emit_insn(ir, MOV64, BPF_REG_5, dst);
+		ir_emit_insn(ir, ALU64_IMM(BPF_XOR, -1), BPF_REG_5, 0);
+		ir_emit_insn(ir, ALU64(BPF_AND), BPF_REG_2, BPF_REG_5);
+		ir_emit_insn(ir, ALU64(BPF_AND), BPF_REG_2, BPF_REG_4);
+		ir_emit_insn(ir, JMP_IMM(BPF_JNE, 0, nul), BPF_REG_2, 0);
+
+		ir_emit_insn(ir, JMP(BPF_JNE, ne), dst, BPF_REG_1);
+	}
+
+	/* all words equal and unterminated so far. */
+	ir_emit_insn(ir, MOV_IMM(0), dst, 0);
+	strcmp_emit_bytes(ir, dst, a, b, NULL, len, done);
+	ir_emit_insn(ir, JMP_IMM(BPF_JA, 0, done), 0, 0);
+
+	/* only keep the bytes up to, and including, the first NUL. */
+	ir_emit_label(ir, nul);
+	ir_emit_insn(ir, MOV64, BPF_REG_5, BPF_REG_2);
+	ir_emit_insn(ir, ALU64_IMM(BPF_NEG, 0), BPF_REG_5, 0);
+	ir_emit_insn(ir, ALU64(BPF_AND), BPF_REG_2, BPF_REG_5);
+	ir_emit_insn(ir, ALU64_IMM(BPF_LSH, 1), BPF_REG_2, 0);
+	ir_emit_insn(ir, ALU64_IMM(BPF_SUB, 1), BPF_REG_2, 0);
+	ir_emit_insn(ir, ALU64(BPF_AND), dst, BPF_REG_2);
+	ir_emit_insn(ir, ALU64(BPF_AND), BPF_REG_1, BPF_REG_2);
+	ir_emit_insn(ir, JMP(BPF_JNE, ne), dst, BPF_REG_1);
+	ir_emit_insn(ir, MOV_IMM(0), dst, 0);
+	ir_emit_insn(ir, JMP_IMM(BPF_JA, 0, done), 0, 0);
+
+	ir_emit_label(ir, ne);
+	ir_emit_insn(ir, END_TO_BE(64), dst, 0);
+	ir_emit_insn(ir, END_TO_BE(64), BPF_REG_1, 0);
+	strcmp_emit_order(ir, dst, done);
+}
+#endif
+
+static void strcmp_emit(struct ir *ir, uint16_t dst,
+			ssize_t a, ssize_t b, const char *blit, size_t len)
+{
+	int16_t done;
+
+	done = ir_alloc_label(ir);
+
+	if (blit)
+		strcmp_emit_literal(ir, dst, a, blit, len, done);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	else if ((len >= 8) && !(a & 7) && !(b & 7))
+		strcmp_emit_words(ir, dst, a, b, len, done);
+#endif
+	else
+		strcmp_emit_bytes(ir, dst, a, b, NULL, len, done);
 
 	ir_emit_label(ir, done);
 }
@@ -188,9 +328,9 @@ static int mem_type_infer(const struct func *func, struct node *n)
 		}
 
 		sz = (size_t)len->num.u64;
-		if (sz > MAX_BPF_STACK) {
+		if (sz > IR_SCRATCH_MAX) {
 			_ne(n, "length is larger than the maximum "
-			    "allowed stack size (%d).", MAX_BPF_STACK);
+			    "allowed size (%d).", IR_SCRATCH_MAX);
 			return -EINVAL;
 		}
 	}
@@ -238,7 +378,6 @@ static int struct_deref_rewrite(const struct func *func, struct node *n,
 			node_string(&member->loc, member->string.data),
 			NULL);
 
-	/* TODO: n leaked */
 	node_replace(n, new);
 	return 1;
 }
@@ -294,6 +433,39 @@ __ply_built_in const struct func struct_deref_func = {
 };
 
 
+/* (*ptr).member, where ptr points to the program context (e.g. the
+ * registers of a kprobe or the data of a tracepoint), can be loaded
+ * straight from the context instead of going through probe_read. the
+ * verifier only allows naturally aligned scalar loads though, and
+ * hides the common fields at the start of a tracepoint's data. so
+ * this returns the member's offset if that is possible, -1
+ * otherwise. */
+static ssize_t struct_dot_ctx_offset(struct node *n, struct ply_probe *pb)
+{
+	struct node *sou, *member, *ptr;
+	ssize_t offset;
+	size_t size;
+
+	sou = n->expr.args;
+	member = sou->next;
+	ptr = sou->expr.args;
+
+	if (!node_is(sou, "u*") || !ptr->sym->func->ctx)
+		return -1;
+
+	offset = type_offsetof(type_base(sou->sym->type), member->string.data);
+	size = type_sizeof(n->sym->type);
+
+	if ((offset < 0) || (bpf_width(size) < 0) || (offset % size))
+		return -1;
+
+	if ((pb->provider->prog_type == BPF_PROG_TYPE_TRACEPOINT)
+	    && (offset < (ssize_t)sizeof(uint64_t)))
+		return -1;
+
+	return offset;
+}
+
 static int struct_dot_ir_pre(const struct func *func, struct node *n,
 				struct ply_probe *pb)
 {
@@ -305,8 +477,10 @@ static int struct_dot_ir_pre(const struct func *func, struct node *n,
 		sou->sym->irs.hint.dot = 1;
 
 		/* this also means we need to put ourselves on the
-		 * stack since data will be loaded via probe_read */
-		n->sym->irs.hint.stack = 1;
+		 * stack since data will be loaded via probe_read,
+		 * unless it can be read from the context. */
+		if (struct_dot_ctx_offset(n, pb) < 0)
+			n->sym->irs.hint.stack = 1;
 	}
 	return 0;
 }
@@ -332,6 +506,27 @@ static int struct_dot_ir_post(const struct func *func, struct node *n,
 		 * read the member we're interested in. */
 		struct node *ptr = sou->expr.args;
 
+		if (struct_dot_ctx_offset(n, pb) >= 0) {
+			int width = bpf_width(dst->size);
+			uint16_t reg, base;
+
+			reg = (dst->loc == LOC_REG) ? dst->reg : BPF_REG_0;
+
+			if (ptr->sym->irs.loc == LOC_REG) {
+				base = ptr->sym->irs.reg;
+			} else {
+				ir_emit_sym_to_reg(pb->ir, reg, ptr->sym);
+				base = reg;
+			}
+
+			ir_emit_insn(pb->ir, LDX(width, offset), reg, base);
+
+			if (dst->loc != LOC_REG)
+				ir_emit_insn(pb->ir, STX(width, dst->stack),
+					     BPF_REG_BP, reg);
+			return 0;
+		}
+
 		ir_emit_sym_to_reg(pb->ir, BPF_REG_3, ptr->sym);
 		ir_emit_insn(pb->ir, ALU64_IMM(BPF_ADD, offset), BPF_REG_3, 0);
 		goto probe_read;
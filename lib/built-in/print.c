@@ -332,6 +332,110 @@ static int print_rewrite(const struct func *func, struct node *n,
 	return 1;
 }
 
+/* print(@map) and clear(@map) can not be done from the kernel. the
+ * probe only sends an event, the map is then dumped or cleared by
+ * userspace when it is received. */
+
+static struct ply_return map_print_ev_handler(struct buffer_ev *ev, void *_sym)
+{
+	ply_map_print(_sym);
+	return (struct ply_return){ };
+}
+
+static struct ply_return map_clear_ev_handler(struct buffer_ev *ev, void *_sym)
+{
+	ply_map_clear(_sym);
+	return (struct ply_return){ };
+}
+
+static int map_action_rewrite(const struct func *func, struct node *n,
+			      struct ply_probe *pb)
+{
+	struct node *bwrite, *ev;
+	struct buffer_evh *evh;
+	uint64_t id;
+
+	evh = n->sym->priv;
+	id = evh->id;
+
+	ev = node_expr(&n->loc, ":struct",
+		       __node_num(&n->loc, sizeof(evh->id), NULL, &id),
+		       NULL);
+
+	bwrite = node_expr(&n->loc, "bwrite",
+			   node_expr(&n->loc, "ctx", NULL),
+			   node_expr(&n->loc, "stdbuf", NULL),
+			   ev,
+			   NULL);
+
+	node_replace(n, bwrite);
+	return 1;
+}
+
+static int map_action_type_infer(struct node *n,
+				 struct ply_return (*handle)(struct buffer_ev *,
+							     void *))
+{
+	struct node *map = n->expr.args;
+	struct buffer_evh *evh;
+
+	evh = xcalloc(1, sizeof(*evh));
+
+	evh->handle = handle;
+	evh->priv = map->sym;
+	buffer_evh_register(evh);
+
+	/* TODO: leaked */
+	n->sym->priv = evh;
+	n->sym->type = &t_void;
+	return 0;
+}
+
+static int is_map_ident(struct node *n)
+{
+	return (n->ntype == N_EXPR) && n->expr.ident && !node_is(n, "[]")
+		&& n->sym->type && (type_base(n->sym->type)->ttype == T_MAP);
+}
+
+static int clear_type_infer(const struct func *func, struct node *n)
+{
+	struct node *map = n->expr.args;
+
+	if (n->sym->type)
+		return 0;
+
+	if (!map->sym->type)
+		return 0;
+
+	if (!is_map_ident(map)) {
+		_ne(map, "argument to '%N' must be a map, "
+		    "but '%N' is of type '%T'\n", n, map, map->sym->type);
+		return -EINVAL;
+	}
+
+	return map_action_type_infer(n, map_clear_ev_handler);
+}
+
+__ply_built_in const struct func clear_func = {
+	.name = "clear",
+	.type = &t_unary_func,
+	.type_infer = clear_type_infer,
+
+	.rewrite = map_action_rewrite,
+};
+
+
+static int print_rewrite_any(const struct func *func, struct node *n,
+			     struct ply_probe *pb)
+{
+	struct buffer_evh *evh = n->sym->priv;
+
+	if (evh->handle == map_print_ev_handler)
+		return map_action_rewrite(func, n, pb);
+
+	return print_rewrite(func, n, pb);
+}
+
 static int print_type_infer(const struct func *func, struct node *n)
 {
 	struct node *expr = n->expr.args;
@@ -340,6 +444,15 @@ static int print_type_infer(const struct func *func, struct node *n)
 	if (n->sym->type)
 		return 0;
 
+	/* a lone identifier might be a map, whose type is not
+	 * necessarily known yet. */
+	if (expr && !expr->next && (expr->ntype == N_EXPR)
+	    && expr->expr.ident && !expr->sym->type)
+		return 0;
+
+	if (expr && !expr->next && is_map_ident(expr))
+		return map_action_type_infer(n, map_print_ev_handler);
+
 	evh = xcalloc(1, sizeof(*evh));
 
 	evh->handle = print_ev_handler;
@@ -356,5 +469,5 @@ __ply_built_in const struct func print_func = {
 	.type = &t_vargs_func,
 	.type_infer = print_type_infer,
 
-	.rewrite = print_rewrite,
+	.rewrite = print_rewrite_any,
 };
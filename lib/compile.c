@@ -10,14 +10,28 @@
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <string.h>
+#include <time.h>
 
 #include <ply/ply.h>
 #include <ply/internal.h>
 
+#include "built-in/built-in.h"
+
+static struct provider *built_in_provider(void)
+{
+	static struct provider *built_in;
+
+	if (!built_in)
+		built_in = provider_get("!built-in");
+
+	return built_in;
+}
+
 static int pass_sym_alloc(struct node *n, void *_pb)
 {
 	struct ply_probe *pb = _pb;
-	struct provider *built_in = provider_get("!built-in");
+	struct provider *built_in = built_in_provider();
 	int err = 0;
 
 	if (n->sym)
@@ -46,61 +60,360 @@ static int pass_sym_alloc(struct node *n, void *_pb)
 }
 
 
-static int pass_type_infer(struct node *n, void *_pb)
+/* Type inference and rewriting is driven by a worklist of nodes. A
+ * node is revisited only when something it depends on changes, i.e.
+ * the type of one of its children, or of a symbol that it shares
+ * with other nodes (maps, for example). */
+
+struct infer_item {
+	struct node *n;
+	struct ply_probe *pb;
+};
+
+struct infer_list {
+	struct infer_item *items;
+	size_t len, size;
+};
+
+struct infer_snap {
+	struct node *n;
+	struct type *type;
+};
+
+struct infer {
+	struct infer_list queue;
+	size_t head;
+
+	/* nodes that are ready to be rewritten */
+	struct infer_list rewrites;
+
+	/* identifiers may share a symbol with other nodes, possibly in
+	 * other probes. */
+	struct infer_list idents;
+
+	struct infer_snap *snap;
+	size_t snap_size;
+};
+
+static void infer_list_add(struct infer_list *l, struct node *n,
+			   struct ply_probe *pb)
 {
-	struct ply_probe *pb = _pb;
+	if (l->len == l->size) {
+		l->size = l->size ? l->size * 2 : 0x100;
+		l->items = realloc(l->items, l->size * sizeof(*l->items));
+		assert(l->items);
+	}
+
+	l->items[l->len].n = n;
+	l->items[l->len].pb = pb;
+	l->len++;
+}
+
+static void infer_push(struct infer *inf, struct node *n, struct ply_probe *pb)
+{
+	if (n->queued)
+		return;
+
+	n->queued = 1;
+	infer_list_add(&inf->queue, n, pb);
+}
+
+static void infer_push_tree(struct infer *inf, struct node *n,
+			    struct ply_probe *pb)
+{
+	struct node *arg;
+
+	if (n->ntype == N_EXPR) {
+		node_expr_foreach(n, arg)
+			infer_push_tree(inf, arg, pb);
+	}
+
+	infer_push(inf, n, pb);
+}
+
+/* queue nodes created by a rewrite, existing nodes that were merely
+ * moved are already up to date. */
+static void infer_push_new(struct infer *inf, struct node *n,
+			   struct ply_probe *pb)
+{
+	struct node *arg;
+
+	if (n->sym)
+		return;
+
+	if (n->ntype == N_EXPR) {
+		node_expr_foreach(n, arg)
+			infer_push_new(inf, arg, pb);
+	}
+
+	infer_push(inf, n, pb);
+}
+
+static void __infer_notify(struct infer *inf, struct node *n,
+			   struct ply_probe *pb, struct node *self)
+{
+	if (n != self)
+		infer_push(inf, n, pb);
+
+	if (n->up)
+		infer_push(inf, n->up, pb);
+}
+
+/* the type of n's symbol has changed, queue everything that might
+ * depend on it, except for the node that made the change. */
+static void infer_notify(struct infer *inf, struct node *n,
+			 struct ply_probe *pb, struct node *self)
+{
+	struct infer_item *it;
+
+	if ((n->ntype != N_EXPR) || !n->expr.ident) {
+		__infer_notify(inf, n, pb, self);
+		return;
+	}
+
+	for (it = inf->idents.items; it < &inf->idents.items[inf->idents.len]; it++) {
+		if (it->n->sym == n->sym)
+			__infer_notify(inf, it->n, it->pb, self);
+	}
+}
+
+/* type_infer callbacks may assign types to the node itself, its
+ * arguments and, in the case of assignments to maps, their
+ * arguments. so record those before the call. */
+static size_t infer_snap_take(struct infer *inf, struct node *n)
+{
+	struct node *arg, *grand;
+	size_t len = 0, need = 1;
+
+	if (n->ntype == N_EXPR) {
+		node_expr_foreach(n, arg) {
+			need++;
+			if (arg->ntype != N_EXPR)
+				continue;
+
+			node_expr_foreach(arg, grand)
+				need++;
+		}
+	}
+
+	if (need > inf->snap_size) {
+		inf->snap_size = need;
+		inf->snap = realloc(inf->snap, need * sizeof(*inf->snap));
+		assert(inf->snap);
+	}
+
+	inf->snap[len++] = (struct infer_snap) { n, n->sym->type };
+	if (n->ntype != N_EXPR)
+		return len;
+
+	node_expr_foreach(n, arg) {
+		inf->snap[len++] = (struct infer_snap) { arg, arg->sym->type };
+
+		if (arg->ntype != N_EXPR)
+			continue;
+
+		node_expr_foreach(arg, grand) {
+			inf->snap[len++] = (struct infer_snap) {
+				grand, grand->sym ? grand->sym->type : NULL
+			};
+		}
+	}
+
+	return len;
+}
+
+static int infer_type(struct infer *inf, struct node *n, struct ply_probe *pb)
+{
+	const struct func *func = n->sym->func;
+	struct node *arg;
+	size_t i, len;
+	int err;
+
+	if (!func->type_infer)
+		return 0;
+
+	/* wait for symbols to be allocated for all arguments, we will
+	 * be notified once that happens. */
+	if (n->ntype == N_EXPR) {
+		node_expr_foreach(n, arg) {
+			if (!arg->sym)
+				return 0;
+		}
+	}
+
+	len = infer_snap_take(inf, n);
+
+	err = func->type_infer(func, n);
+	if (err)
+		return err;
 
-	if (n->sym->func->type_infer)
-		return n->sym->func->type_infer(n->sym->func, n);
+	for (i = 0; i < len; i++) {
+		struct node *m = inf->snap[i].n;
+
+		if (m->sym && (m->sym->type != inf->snap[i].type))
+			infer_notify(inf, m, pb, n);
+	}
 
 	return 0;
 }
 
-static int pass_type_report(struct node *n, void *_pb)
+static int infer_rewrite(struct infer *inf, struct node *n,
+			 struct ply_probe *pb)
 {
-	if (!n->sym->type)
-		_ne(n, "type of symbol '%N' is unknown\n", n);
+	const struct func *func = n->sym->func;
+	struct node *new, *arg;
+	int err;
+
+	if (n->rewritten)
+		return 0;
+
+	n->rewritten = 1;
+
+	err = func->rewrite(func, n, pb);
+	if (err < 0)
+		return err;
+
+	/* find out if n was replaced, in which case the new subtree
+	 * is now in n's old position. */
+	if (n->prev)
+		new = n->prev->next;
+	else if (n->up)
+		new = n->up->expr.args;
+	else
+		new = n;
+
+	if (new->ntype == N_EXPR) {
+		node_expr_foreach(new, arg)
+			infer_push_new(inf, arg, pb);
+	}
+
+	infer_push(inf, new, pb);
+	if (new->up)
+		infer_push(inf, new->up, pb);
 
 	return 0;
 }
 
-static int pass_type_validate(struct node *n, void *_pb)
+static int infer_one(struct infer *inf, struct node *n, struct ply_probe *pb)
 {
-	if (!n->sym->type)
-		return -EINVAL;
+	int err;
+
+	if (!n->sym) {
+		err = pass_sym_alloc(n, pb);
+		if (err)
+			return err;
+
+		if ((n->ntype == N_EXPR) && n->expr.ident)
+			infer_list_add(&inf->idents, n, pb);
+
+		infer_notify(inf, n, pb, n);
+	}
+
+	err = infer_type(inf, n, pb);
+	if (err)
+		return err;
+
+	/* rewrites generally depend on information gathered during
+	 * type inference, so they are held back until the types
+	 * have settled. each node is rewritten at most once. */
+	if (n->sym->func->rewrite && !n->rewritten && n->sym->type)
+		infer_list_add(&inf->rewrites, n, pb);
 
 	return 0;
 }
 
-static int pass_rewrite(struct node *n, void *_pb)
+static int run_infer(struct ply *ply)
 {
-	struct ply_probe *pb = _pb;
+	struct infer inf = { 0 };
+	struct infer_item it;
+	struct ply_probe *pb;
+	size_t i;
+	int err = 0;
+
+	ply_probe_foreach(ply, pb)
+		infer_push_tree(&inf, pb->ast, pb);
+
+	while (!err && (inf.head < inf.queue.len)) {
+		while (!err && (inf.head < inf.queue.len)) {
+			it = inf.queue.items[inf.head++];
+			it.n->queued = 0;
+
+			err = infer_one(&inf, it.n, it.pb);
+		}
+
+		inf.head = inf.queue.len = 0;
+
+		for (i = 0; !err && (i < inf.rewrites.len); i++) {
+			it = inf.rewrites.items[i];
+			err = infer_rewrite(&inf, it.n, it.pb);
+		}
+
+		inf.rewrites.len = 0;
+	}
+
+	free(inf.queue.items);
+	free(inf.rewrites.items);
+	free(inf.idents.items);
+	free(inf.snap);
+	return err;
+}
+
+/* a map as a whole can only be passed to print and clear, which have
+ * rewritten those uses by now. any remaining map that is not
+ * indexed has been used as a value, which it can not be. */
+static int pass_map_validate(struct node *n, void *_pb)
+{
+	if ((n->ntype != N_EXPR) || (n->sym->func != &ident_func)
+	    || !n->sym->type || (type_base(n->sym->type)->ttype != T_MAP))
+		return 0;
+
+	if (n->up && node_is(n->up, "[]") && (n->up->expr.args == n))
+		return 0;
+
+	_ne(n, "map '%N' can only be indexed, or be the only argument "
+	    "to print or clear\n", n);
+	return -EINVAL;
+}
 
-	if (n->sym->func->rewrite)
-		return n->sym->func->rewrite(n->sym->func, n, pb);
+static int pass_type_report(struct node *n, void *_pb)
+{
+	if (!n->sym->type)
+		_ne(n, "type of symbol '%N' is unknown\n", n);
+
+	return 0;
+}
+
+static int pass_type_validate(struct node *n, void *_pb)
+{
+	if (!n->sym->type)
+		return -EINVAL;
 
 	return 0;
 }
 
-static char *pass_ir_comment(struct node *n, const char *phase)
+static const char *pass_ir_comment(struct node *n, const char *phase)
 {
-	char *comment;
+	char *tmp = NULL;
+	const char *comment;
 
 	switch (n->ntype) {
 	case N_EXPR:
-		asprintf(&comment, "%s %s()", phase, n->expr.func);
+		asprintf(&tmp, "%s %s()", phase, n->expr.func);
 		break;
 	case N_STRING:
-		asprintf(&comment, "%s \"%s\"", phase, n->string.data);
+		asprintf(&tmp, "%s \"%s\"", phase, n->string.data);
 		break;
 	case N_NUM:
 		if (n->num.unsignd)
-			asprintf(&comment, "%s <%#" PRIx64 ">", phase, n->num.u64);
+			asprintf(&tmp, "%s <%#" PRIx64 ">", phase, n->num.u64);
 		else
-			asprintf(&comment, "%s <%" PRId64 ">", phase, n->num.s64);
+			asprintf(&tmp, "%s <%" PRId64 ">", phase, n->num.s64);
 		break;
 	}
 
+	assert(tmp);
+	comment = astrdup(tmp);
+	free(tmp);
 	return comment;
 }
 
@@ -109,12 +422,12 @@ static int pass_ir_pre(struct node *n, void *_pb)
 	struct ply_probe *pb = _pb;
 	int err = 0;
 
-	ir_emit_comment(pb->ir, pass_ir_comment(n, ">pre ")); /* TODO comment leaked */
+	ir_emit_comment(pb->ir, pass_ir_comment(n, ">pre "));
 
 	if (n->sym->func->ir_pre)
 		err = n->sym->func->ir_pre(n->sym->func, n, pb);
 
-	/* ir_emit_comment(pb->ir, pass_ir_comment(n, "<pre ")); /\* TODO comment leaked *\/ */
+	/* ir_emit_comment(pb->ir, pass_ir_comment(n, "<pre ")); */
 	return err;
 }
 
@@ -123,12 +436,12 @@ static int pass_ir_post(struct node *n, void *_pb)
 	struct ply_probe *pb = _pb;
 	int err = 0;
 
-	ir_emit_comment(pb->ir, pass_ir_comment(n, ">post")); /* TODO comment leaked */
+	ir_emit_comment(pb->ir, pass_ir_comment(n, ">post"));
 
 	if (n->sym->func->ir_post)
 		err = n->sym->func->ir_post(n->sym->func, n, pb);
 
-	/* ir_emit_comment(pb->ir, pass_ir_comment(n, "<post")); /\* TODO comment leaked *\/ */
+	/* ir_emit_comment(pb->ir, pass_ir_comment(n, "<post")); */
 	return err;
 }
 
@@ -148,7 +461,7 @@ static int run_walk(struct ply *ply, nwalk_fn pre, nwalk_fn post)
 
 static int run_ir(struct ply *ply)
 {
-	struct provider *built_in = provider_get("!built-in");
+	struct provider *built_in = built_in_provider();
 	struct ply_probe *pb;
 	int err;
 
@@ -183,46 +496,197 @@ static int run_ir(struct ply *ply)
 	return 0;
 }
 
+static const struct func scratch_func = {
+	.name = ":scratch",
+};
+
+/* every probe has a scratch area of its own. programs may nest on
+ * the same cpu, e.g. a kprobe hit from an irq while an fentry program
+ * is running, and would then overwrite each other's temporaries. */
+static struct sym *scratch_get(struct ply_probe *pb)
+{
+	struct ply_probe *it;
+	struct sym *scratch;
+	char name[0x20];
+	int i = 0;
+
+	ply_probe_foreach(pb->ply, it) {
+		if (it == pb)
+			break;
+		i++;
+	}
+
+	snprintf(name, sizeof(name), "%s%d", scratch_func.name, i);
+
+	scratch = sym_get(&pb->ply->globals, name);
+	if (scratch)
+		return scratch;
+
+	return __sym_alloc(&pb->ply->globals, astrdup(name), &scratch_func);
+}
+
+static struct sym *cache_sym(const char *name, void *_pb)
+{
+	struct ply_probe *pb = _pb;
+
+	/* the cached program may have been generated for a probe at
+	 * another position, its scratch area is always our own. */
+	if (!strncmp(name, scratch_func.name, strlen(scratch_func.name)))
+		return scratch_get(pb);
+
+	return sym_get(&pb->ply->globals, name);
+}
+
+static int cache_write(FILE *fp, void *_ir)
+{
+	return ir_fwrite(_ir, fp);
+}
+
+/* the IR, before any registers or stack slots have been assigned,
+ * captures everything that the generated program depends on. so
+ * if we have seen it before, the result can be reused. */
+static int run_bpf_cached(struct ply *ply, struct ply_probe *pb,
+			  uint64_t key)
+{
+	FILE *fp;
+	int err;
+
+	fp = cache_open(key);
+	if (!fp)
+		return -ENOENT;
+
+	err = ir_fread(pb->ir, fp, cache_sym, pb);
+	fclose(fp);
+
+	if (err) {
+		_d("%s: ignoring invalid cache entry %016"PRIx64"\n",
+		   pb->probe, key);
+	}
+
+	return err;
+}
+
+static void scratch_type(struct ply_probe *pb)
+{
+	struct sym *scratch = pb->ir->scratch;
+
+	if (!scratch)
+		return;
+
+	/* the map is created even if the temporaries ended up
+	 * fitting on the stack, which needs a non-zero size. */
+	scratch->type = type_map_of(&t_u32,
+				    type_array_of(&t_char,
+						  pb->ir->scratch_size ? : 8),
+				    BPF_MAP_TYPE_PERCPU_ARRAY, 1);
+}
+
 static int run_bpf(struct ply *ply)
 {
 	struct ply_probe *pb;
+	uint64_t seed = 0, key = 0;
 	int err;
 
+	if (ply_config.cache)
+		seed = cache_seed();
+
 	ply_probe_foreach(ply, pb) {
+		/* until ir_bpf_generate, every temporary has a slot of
+		 * its own, whose offset must fit in an instruction. */
+		if (pb->ir->sp <= INT16_MIN) {
+			_e("%s: temporaries require %zd bytes of stack, "
+			   "the maximum is %d\n", pb->probe, -pb->ir->sp,
+			   INT16_MAX);
+			return -E2BIG;
+		}
+
+		if (ply_config.cache) {
+			key = ir_hash(pb->ir, seed);
+
+			if (!run_bpf_cached(ply, pb, key)) {
+				scratch_type(pb);
+				continue;
+			}
+		}
+
+		/* the initial layout is an upper bound on stack
+		 * usage, only look closer if it does not fit. */
+		if ((-pb->ir->sp > MAX_BPF_STACK)
+		    && (ir_bpf_stack_usage(pb->ir) > MAX_BPF_STACK))
+			pb->ir->scratch = scratch_get(pb);
+
 		err = ir_bpf_generate(pb->ir);
 		if (err)
 			return err;
+
+		scratch_type(pb);
+
+		if (ply_config.cache) {
+			err = cache_put(key, cache_write, pb->ir);
+			if (err) {
+				_d("%s: unable to cache program: %s\n",
+				   pb->probe, strerror(-err));
+			}
+		}
 	}
 
 	return 0;
 }
 
-int ply_compile(struct ply *ply)
+static int run_type(struct ply *ply)
 {
-	struct pass *pass;
-	int err = 0, rewrites;
+	int err;
 
-	for (rewrites = 0; rewrites < 10; rewrites++) {
-		err =         run_walk(ply, NULL, pass_sym_alloc);
-		err = err ? : run_walk(ply, NULL, pass_type_infer);
-		err = err ? : run_walk(ply, NULL, pass_rewrite);
-		if (err < 0)
-			return err;
+	err = run_walk(ply, NULL, pass_map_validate);
+	err = err ? : run_walk(ply, NULL, pass_type_report);
+	return err ? : run_walk(ply, NULL, pass_type_validate);
+}
 
-		if (!err)
-			break;
-	}
+static const struct {
+	const char *name;
+	int (*run)(struct ply *ply);
+} passes[] = {
+	{ "infer", run_infer },
+	{ "type",  run_type },
+	{ "ir",    run_ir },
+	{ "bpf",   run_bpf },
 
-	assert(!err);
+	{ NULL }
+};
 
-	err = err ? : run_walk(ply, NULL, pass_sym_alloc);
-	err = err ? : run_walk(ply, NULL, pass_type_infer);
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
 
-	err = err ? : run_walk(ply, NULL, pass_type_report);
-	err = err ? : run_walk(ply, NULL, pass_type_validate);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int ply_compile(struct ply *ply)
+{
+	struct ply_pass *pass;
+	struct arena *prev;
+	uint64_t start;
+	int i, err = 0;
+
+	prev = arena_enter(&ply->arena);
+
+	for (i = 0; !err && passes[i].name; i++) {
+		assert(i < (int)(sizeof(ply->passes) / sizeof(*pass)) - 1);
+		pass = &ply->passes[i];
+
+		start = now_ns();
+		err = passes[i].run(ply);
+
+		pass->name = passes[i].name;
+		pass->ns = now_ns() - start;
+	}
 
-	err = err ? : run_ir(ply);
-	err = err ? : run_bpf(ply);
+	/* every program and tracepoint format has been through the
+	 * cache by now. */
+	if (ply_config.cache)
+		cache_prune();
 
+	arena_leave(prev);
 	return err;
 }
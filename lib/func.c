@@ -103,3 +103,22 @@ struct type *func_return_type(const struct func *func)
 
 	return func->type;
 }
+
+/* helpers for funcs that are aliases of the program context, e.g.
+ * kprobe's regs. the ctx is passed as an argument, so that the
+ * alias shares its irstate. */
+int func_ctx_rewrite(const struct func *func, struct node *n,
+		     struct ply_probe *pb)
+{
+	node_expr_append(&n->loc, n, node_expr(&n->loc, "ctx", NULL));
+	return 0;
+}
+
+int func_ctx_ir_post(const struct func *func, struct node *n,
+		     struct ply_probe *pb)
+{
+	struct node *ctx = n->expr.args;
+
+	n->sym->irs = ctx->sym->irs;
+	return 0;
+}
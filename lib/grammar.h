@@ -0,0 +1,143 @@
+/* A Bison parser, made by GNU Bison 3.8.2.  */
+
+/* Bison interface for Yacc-like parsers in C
+
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* As a special exception, you may create a larger work that contains
+   part or all of the Bison parser skeleton and distribute that work
+   under terms of your choice, so long as that work isn't itself a
+   parser generator using the skeleton or a modified version thereof
+   as a parser skeleton.  Alternatively, if you modify or redistribute
+   the parser skeleton itself, you may (at your option) remove this
+   special exception, which will cause the skeleton and the resulting
+   Bison output files to be licensed under the GNU General Public
+   License without this special exception.
+
+   This special exception was added by the Free Software Foundation in
+   version 2.2 of Bison.  */
+
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
+#ifndef YY_YY_GRAMMAR_H_INCLUDED
+# define YY_YY_GRAMMAR_H_INCLUDED
+/* Debug traces.  */
+#ifndef YYDEBUG
+# define YYDEBUG 0
+#endif
+#if YYDEBUG
+extern int yydebug;
+#endif
+/* "%code requires" blocks.  */
+#line 19 "grammar.y"
+
+#include <ply/node.h>
+
+#define YYLTYPE struct nloc
+
+struct ply;
+
+#line 57 "grammar.h"
+
+/* Token kinds.  */
+#ifndef YYTOKENTYPE
+# define YYTOKENTYPE
+  enum yytokentype
+  {
+    YYEMPTY = -2,
+    YYEOF = 0,                     /* "end of file"  */
+    YYerror = 256,                 /* error  */
+    YYUNDEF = 257,                 /* "invalid token"  */
+    ENDPRED = 258,                 /* ENDPRED  */
+    IF = 259,                      /* IF  */
+    ELSE = 260,                    /* ELSE  */
+    RETURN = 261,                  /* RETURN  */
+    DELETE = 262,                  /* DELETE  */
+    EQ = 263,                      /* EQ  */
+    NE = 264,                      /* NE  */
+    LE = 265,                      /* LE  */
+    GE = 266,                      /* GE  */
+    LSH = 267,                     /* LSH  */
+    RSH = 268,                     /* RSH  */
+    AND = 269,                     /* AND  */
+    XOR = 270,                     /* XOR  */
+    OR = 271,                      /* OR  */
+    DEREF = 272,                   /* DEREF  */
+    PSPEC = 273,                   /* PSPEC  */
+    IDENT = 274,                   /* IDENT  */
+    AGG = 275,                     /* AGG  */
+    STRING = 276,                  /* STRING  */
+    NUMBER = 277                   /* NUMBER  */
+  };
+  typedef enum yytokentype yytoken_kind_t;
+#endif
+/* Token kinds.  */
+#define YYEMPTY -2
+#define YYEOF 0
+#define YYerror 256
+#define YYUNDEF 257
+#define ENDPRED 258
+#define IF 259
+#define ELSE 260
+#define RETURN 261
+#define DELETE 262
+#define EQ 263
+#define NE 264
+#define LE 265
+#define GE 266
+#define LSH 267
+#define RSH 268
+#define AND 269
+#define XOR 270
+#define OR 271
+#define DEREF 272
+#define PSPEC 273
+#define IDENT 274
+#define AGG 275
+#define STRING 276
+#define NUMBER 277
+
+/* Value type.  */
+#if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
+typedef  struct node *  YYSTYPE;
+# define YYSTYPE_IS_TRIVIAL 1
+# define YYSTYPE_IS_DECLARED 1
+#endif
+
+/* Location type.  */
+#if ! defined YYLTYPE && ! defined YYLTYPE_IS_DECLARED
+typedef struct YYLTYPE YYLTYPE;
+struct YYLTYPE
+{
+  int first_line;
+  int first_column;
+  int last_line;
+  int last_column;
+};
+# define YYLTYPE_IS_DECLARED 1
+# define YYLTYPE_IS_TRIVIAL 1
+#endif
+
+
+
+
+int yyparse (void *scanner, struct ply *ply);
+
+
+#endif /* !YY_YY_GRAMMAR_H_INCLUDED  */
@@ -208,6 +208,7 @@ basic
 : NUMBER
 | STRING
 | IDENT
+| AGG
 | '(' expr ')'	{ $$ = $2; }
 ;
 
@@ -26,6 +26,8 @@ static const char *bpf_func_name(enum bpf_func_id id)
 		return "get_current_pid_tgid";
 	case BPF_FUNC_get_current_uid_gid:
 		return "get_current_uid_gid";
+	case BPF_FUNC_get_smp_processor_id:
+		return "get_smp_processor_id";
 	case BPF_FUNC_get_stackid:
 		return "get_stackid";
 	case BPF_FUNC_ktime_get_ns:
@@ -143,6 +145,13 @@ static void __insn_dump(const struct bpf_insn insn, uint16_t dst, uint16_t src,
 
 	case BPF_ALU:
 	case BPF_ALU64:
+		if (BPF_OP(insn.code) == BPF_END) {
+			fprintf(fp, "%s%d\t", BPF_SRC(insn.code) == BPF_TO_BE ?
+				"be" : "le", insn.imm);
+			reg_dump(dst, 0, fp);
+			return;
+		}
+
 		alu_dump(insn.code, fp);
 		break;
 
@@ -156,6 +165,11 @@ static void __insn_dump(const struct bpf_insn insn, uint16_t dst, uint16_t src,
 		case BPF_CALL:
 			fputs("call\t", fp);
 
+			if (src == BPF_PSEUDO_CALL) {
+				offset_dump(insn.imm, fp);
+				return;
+			}
+
 			name = bpf_func_name(insn.imm);
 			if (name)
 				fputs(name, fp);
@@ -223,6 +237,13 @@ void insn_dump(struct bpf_insn insn, FILE *fp)
 	__insn_dump(insn, insn.dst_reg, insn.src_reg, fp);
 }
 
+static int vinsn_is_subprog_call(struct vinsn *vi)
+{
+	return (vi->vitype == VI_INSN)
+		&& (vi->insn.bpf.code == (BPF_JMP | BPF_CALL))
+		&& (vi->insn.src == BPF_PSEUDO_CALL);
+}
+
 void vinsn_dump(struct vinsn *vi, FILE *fp)
 {
 	switch (vi->vitype) {
@@ -266,12 +287,131 @@ void ir_dump(struct ir *ir, FILE *fp)
 	}
 }
 
+struct ir_map_stats {
+	struct sym *sym;
+	unsigned lookup, update, delete;
+};
+
+static struct ir_map_stats *ir_map_stats_get(struct ir_map_stats **maps,
+					     size_t *n_maps, struct sym *sym)
+{
+	struct ir_map_stats *ms;
+
+	for (ms = *maps; ms < &(*maps)[*n_maps]; ms++) {
+		if (ms->sym == sym)
+			return ms;
+	}
+
+	*maps = realloc(*maps, (*n_maps + 1) * sizeof(**maps));
+	assert(*maps);
+
+	ms = &(*maps)[(*n_maps)++];
+	memset(ms, 0, sizeof(*ms));
+	ms->sym = sym;
+	return ms;
+}
+
+/* Summarize the cost of a generated program. Map operations are
+ * attributed to the map that was last loaded into r1, which is where
+ * all map helpers expect it. */
+void ir_stats_dump(struct ir *ir, FILE *fp)
+{
+	unsigned calls[__BPF_FUNC_MAX_ID] = { 0 };
+	struct ir_map_stats *maps = NULL, *ms;
+	struct sym *r1map = NULL;
+	struct vinsn *vi;
+	size_t n_maps = 0;
+	int i, n_insns = 0, n_subcalls = 0;
+	const char *name;
+
+	for (vi = ir->vi; vi < &ir->vi[ir->len]; vi++) {
+		switch (vi->vitype) {
+		case VI_LDMAP:
+			n_insns++;
+			r1map = (vi->map.reg == BPF_REG_1) ? vi->map.sym : NULL;
+			break;
+		case VI_INSN:
+			n_insns++;
+
+			if (vinsn_is_subprog_call(vi)) {
+				n_subcalls++;
+				break;
+			}
+
+			if (vi->insn.bpf.code != (BPF_JMP | BPF_CALL)) {
+				if (vi->insn.dst == BPF_REG_1)
+					r1map = NULL;
+				break;
+			}
+
+			if (vi->insn.bpf.imm >= 0
+			    && vi->insn.bpf.imm < __BPF_FUNC_MAX_ID)
+				calls[vi->insn.bpf.imm]++;
+
+			if (!r1map)
+				break;
+
+			ms = ir_map_stats_get(&maps, &n_maps, r1map);
+			switch (vi->insn.bpf.imm) {
+			case BPF_FUNC_map_lookup_elem:
+				ms->lookup++;
+				break;
+			case BPF_FUNC_map_update_elem:
+				ms->update++;
+				break;
+			case BPF_FUNC_map_delete_elem:
+				ms->delete++;
+				break;
+			}
+
+			r1map = NULL;
+			break;
+		case VI_LABEL:
+		case VI_COMMENT:
+			break;
+		}
+	}
+
+	fprintf(fp, "insns:   %d\n", n_insns);
+
+	fprintf(fp, "stack:   %zd/%d bytes", -ir->sp, MAX_BPF_STACK);
+	if (ir->scratch_size)
+		fprintf(fp, ", %zu bytes in %s", ir->scratch_size,
+			ir->scratch->name);
+	fputc('\n', fp);
+
+	fprintf(fp, "helpers:");
+	for (i = 0; i < __BPF_FUNC_MAX_ID; i++) {
+		if (!calls[i])
+			continue;
+
+		name = bpf_func_name(i);
+		if (name)
+			fprintf(fp, " %s:%u", name, calls[i]);
+		else
+			fprintf(fp, " #%d:%u", i, calls[i]);
+	}
+	if (n_subcalls)
+		fprintf(fp, " subprog:%d", n_subcalls);
+	fputc('\n', fp);
+
+	for (ms = maps; ms < &maps[n_maps]; ms++) {
+		fprintf(fp, "map %s: lookup:%u update:%u delete:%u\n",
+			ms->sym->name, ms->lookup, ms->update, ms->delete);
+	}
+
+	free(maps);
+}
+
 static void ir_emit(struct ir *ir, struct vinsn *vi)
 {
-	ir->vi = realloc(ir->vi, (++ir->len)*sizeof(*vi));
-	assert(ir->vi);
+	if (ir->len == ir->size) {
+		ir->size = ir->size ? ir->size << 1 : 0x40;
+		ir->vi = realloc(ir->vi, ir->size * sizeof(*vi));
+		assert(ir->vi);
+	}
 
-	ir->vi[ir->len - 1] = *vi;
+	ir->vi[ir->len++] = *vi;
 }
 
 void ir_emit_insn(struct ir *ir, struct bpf_insn bpf, uint16_t dst, uint16_t src)
@@ -504,6 +644,30 @@ void ir_emit_perf_event_output(struct ir *ir,
 	ir_emit_insn(ir, CALL(BPF_FUNC_perf_event_output), 0, 0);
 }
 
+void ir_emit_subprog_call(struct ir *ir, const struct ir_subprog *sp)
+{
+	struct ir_subcall *sub;
+
+	for (sub = ir->subs; sub < &ir->subs[ir->n_subs]; sub++) {
+		if (sub->sp == sp)
+			break;
+	}
+
+	if (sub == &ir->subs[ir->n_subs]) {
+		ir->subs = realloc(ir->subs, (ir->n_subs + 1) * sizeof(*sub));
+		assert(ir->subs);
+
+		sub = &ir->subs[ir->n_subs++];
+		sub->sp = sp;
+		sub->label = ir_alloc_label(ir);
+		sub->calls = 0;
+	}
+
+	/* the target is a label until ir_bpf_jmp_resolve. */
+	sub->calls++;
+	ir_emit_insn(ir, CALL(sub->label), 0, BPF_PSEUDO_CALL);
+}
+
 
 int16_t ir_alloc_label (struct ir *ir)
 {
@@ -517,16 +681,35 @@ uint16_t ir_alloc_register(struct ir *ir)
 
 ssize_t ir_alloc_stack(struct ir *ir, size_t size, size_t align)
 {
+	struct irslot *slot;
+
 	ir->sp -= size;
 
 	if (ir->sp % align)
 		ir->sp -= align - (ir->sp & (align - 1));
 
-	assert(ir->sp > INT16_MIN);
+	/* offsets beyond INT16_MIN can not be encoded, the program
+	 * is rejected before they are used, see run_bpf. */
 
+	ir->slots = realloc(ir->slots, (ir->n_slots + 1) * sizeof(*ir->slots));
+	assert(ir->slots);
+
+	slot = &ir->slots[ir->n_slots++];
+	slot->stack = ir->sp;
+	slot->size = size;
 	return ir->sp;
 }
 
+static ssize_t ir_alignof(struct type *t)
+{
+	/* strings are compared a word at a time when both sides are
+	 * aligned, see strcmp. */
+	if (type_is_string(t) && (type_sizeof(t) >= 8))
+		return max(type_alignof(t), (ssize_t)8);
+
+	return type_alignof(t);
+}
+
 void ir_init_irs(struct ir *ir, struct irstate *irs, struct type *t)
 {
 	t = type_base(t);
@@ -548,7 +731,7 @@ void ir_init_irs(struct ir *ir, struct irstate *irs, struct type *t)
 	/* a parent may already have filled in a stack position.
 	 * usually this is when we're part of a map key. */
 	if (!irs->stack)
-		irs->stack = ir_alloc_stack(ir, irs->size, type_alignof(t));
+		irs->stack = ir_alloc_stack(ir, irs->size, ir_alignof(t));
 }
 
 void ir_init_sym(struct ir *ir, struct sym *sym)
@@ -560,143 +743,903 @@ struct ir *ir_new(void)
 {
 	struct ir *ir;
 
-	ir = xcalloc(1, sizeof(*ir));
+	ir = acalloc(1, sizeof(*ir));
 
 	ir->next_reg = vreg_base;
 	ir->next_label = -1;
 	return ir;
 }
 
+void ir_free(struct ir *ir)
+{
+	free(ir->vi);
+	free(ir->slots);
+	free(ir->subs);
+}
+
 
 /* ir->bpf generation */
 
-static void ir_bpf_vreg_replace(struct ir *ir, struct vinsn *last,
-				uint16_t vreg, int reg)
+/* Stack slot coloring
+ *
+ * ir_alloc_stack hands out a unique slot to every temporary. Once the
+ * program is complete, we figure out the live range of each slot and
+ * let slots whose ranges do not overlap share memory.
+ *
+ * Since only forward jumps are allowed, execution always proceeds
+ * through the IR in increasing order. Therefore a slot is live from
+ * its first reference to its last one, where a reference is either a
+ * load/store relative to bp or the use of a register that holds a
+ * pointer into the slot. The latter are tracked by following ldbp
+ * sequences (mov rX, bp; add rX, #off) through register copies and
+ * jumps. If the program does anything we can not follow, e.g. spills
+ * a stack pointer to memory, the original layout is kept. */
+
+enum {
+	RS_NONE,
+	RS_BP,
+	RS_PTR,
+};
+
+struct regstate {
+	int kind;
+	int slot;
+	int listed;
+};
+
+struct slotpend {
+	size_t next;
+	size_t reg;
+	struct regstate rs;
+};
+
+struct slotscan {
+	struct ir *ir;
+
+	struct regstate *regs;
+	size_t n_regs;
+
+	/* registers that may hold a pointer, used to snapshot the
+	 * state at jumps without looking at every vreg. */
+	size_t *active;
+	size_t n_active;
+
+	/* register states carried by jumps, chained per target */
+	struct slotpend *pend;
+	size_t n_pend;
+	size_t *pend_head;
+
+	size_t *insn_vi;
+	size_t *label_vi;
+	size_t n_labels;
+
+	int *ref;
+	size_t *base;
+	ssize_t *first, *last;
+	int *scratch;
+};
+
+static size_t ir_stack_reg(struct ir *ir, uint16_t reg)
 {
-	struct vinsn *vi;
+	if (reg & vreg_base)
+		return BPF_REG_BP + 1 + (reg & ~vreg_base);
 
-	_d("ir_bpf_generate: v%d -> r%d\n", vreg & ~vreg_base, reg);
+	return reg;
+}
 
-	for (vi = ir->vi; vi <= last; vi++) {
-		if (vi->vitype != VI_INSN)
-			continue;
+static int ir_stack_slot_find(struct ir *ir, ssize_t off)
+{
+	int lo = 0, hi = ir->n_slots - 1, mid;
 
-		if (vi->insn.dst == vreg)
-			vi->insn.dst = reg;
-		if (vi->insn.src == vreg)
-			vi->insn.src = reg;
-	}	
+	/* slots are allocated downwards, so they are sorted by
+	 * descending offset */
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+
+		if (off < ir->slots[mid].stack)
+			lo = mid + 1;
+		else if (off >= ir->slots[mid].stack + (ssize_t)ir->slots[mid].size)
+			hi = mid - 1;
+		else
+			return mid;
+	}
+
+	return -ENOENT;
 }
 
+static void ir_stack_touch(struct slotscan *ss, int slot, size_t i)
+{
+	if (ss->first[slot] < 0)
+		ss->first[slot] = i;
 
-static int ir_bpf_registerize_one(struct ir *ir, struct vinsn *last,
-				  uint16_t vreg)
+	ss->last[slot] = i;
+}
+
+static void __ir_stack_set(struct slotscan *ss, size_t r, int kind, int slot)
 {
-	struct vinsn *vi;
-	uint16_t clean = 0x3ff;
+	if (kind != RS_NONE && !ss->regs[r].listed) {
+		ss->active[ss->n_active++] = r;
+		ss->regs[r].listed = 1;
+	}
 
-	for (vi = ir->vi; clean && (vi < last); vi++) {
-		if (vi->vitype != VI_INSN)
-			continue;
+	ss->regs[r].kind = kind;
+	ss->regs[r].slot = slot;
+}
 
-		if (!(vi->insn.src & vreg_base))
-			clean &= ~(1 << vi->insn.src);
-		if (!(vi->insn.dst & vreg_base))
-			clean &= ~(1 << vi->insn.dst);
-		if ((BPF_CLASS(vi->insn.bpf.code) == BPF_JMP)
-		    && (BPF_OP(vi->insn.bpf.code) == BPF_CALL))
-			clean &= ~BPF_REG_CALLER_SAVE;
+static void ir_stack_set(struct slotscan *ss, uint16_t reg, int kind, int slot)
+{
+	__ir_stack_set(ss, ir_stack_reg(ss->ir, reg), kind, slot);
+}
+
+static struct regstate *ir_stack_get(struct slotscan *ss, uint16_t reg)
+{
+	return &ss->regs[ir_stack_reg(ss->ir, reg)];
+}
+
+static void ir_stack_use(struct slotscan *ss, uint16_t reg, size_t i)
+{
+	struct regstate *rs = ir_stack_get(ss, reg);
+
+	if (rs->kind == RS_PTR)
+		ir_stack_touch(ss, rs->slot, i);
+}
+
+static int ir_stack_ref(struct slotscan *ss, ssize_t off, size_t i)
+{
+	int slot;
+
+	slot = ir_stack_slot_find(ss->ir, off);
+	if (slot < 0)
+		return slot;
+
+	ss->ref[i] = slot;
+	ir_stack_touch(ss, slot, i);
+	return 0;
+}
+
+static void ir_stack_compact(struct slotscan *ss)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < ss->n_active; i++) {
+		if (ss->regs[ss->active[i]].kind != RS_NONE)
+			ss->active[n++] = ss->active[i];
+		else
+			ss->regs[ss->active[i]].listed = 0;
 	}
 
-	if (clean) {
-		int reg;
+	ss->n_active = n;
+}
 
-		for (reg = BPF_REG_0; !(clean & 1); clean >>= 1, reg++);
+static void ir_stack_kill(struct slotscan *ss)
+{
+	size_t i;
 
-		ir_bpf_vreg_replace(ir, last, vreg, reg);
+	for (i = 0; i < ss->n_active; i++) {
+		ss->regs[ss->active[i]].kind = RS_NONE;
+		ss->regs[ss->active[i]].listed = 0;
+	}
+
+	ss->n_active = 0;
+}
+
+static void ir_stack_branch(struct slotscan *ss, size_t target)
+{
+	struct slotpend *p;
+	size_t i;
+
+	ir_stack_compact(ss);
+
+	for (i = 0; i < ss->n_active; i++) {
+		ss->pend = realloc(ss->pend, (ss->n_pend + 1) * sizeof(*ss->pend));
+		assert(ss->pend);
+
+		p = &ss->pend[ss->n_pend++];
+		p->reg = ss->active[i];
+		p->rs = ss->regs[p->reg];
+		p->next = ss->pend_head[target];
+		ss->pend_head[target] = ss->n_pend;
+	}
+}
+
+static int ir_stack_merge(struct slotscan *ss, size_t i)
+{
+	struct slotpend *p;
+	struct regstate *rs;
+	size_t next;
+
+	for (next = ss->pend_head[i]; next; next = p->next) {
+		p = &ss->pend[next - 1];
+		rs = &ss->regs[p->reg];
+
+		if (rs->kind == RS_NONE) {
+			__ir_stack_set(ss, p->reg, p->rs.kind, p->rs.slot);
+		} else if ((rs->kind != p->rs.kind) || (rs->slot != p->rs.slot)) {
+			/* two different pointers meet in the same
+			 * register, give up. */
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int ir_stack_target(struct slotscan *ss, size_t i, size_t n,
+			   int16_t off, size_t *target)
+{
+	if (off < 0) {
+		if ((size_t)-off >= ss->n_labels || !ss->label_vi[-off])
+			return -ENOENT;
+
+		*target = ss->label_vi[-off] - 1;
 		return 0;
 	}
 
-	/* TODO ir_bpf_vreg_spill(ir, last); */
-	return -1;
+	if (n + 1 + off >= ss->ir->len || !ss->insn_vi[n + 1 + off])
+		return -ENOENT;
+
+	*target = ss->insn_vi[n + 1 + off] - 1;
+	return 0;
 }
 
-static int ir_bpf_registerize(struct ir *ir)
+static int ir_stack_scan_insn(struct slotscan *ss, size_t i, size_t n,
+			      int *dead)
 {
-	struct vinsn *vi;
-	int err = 0;
+	struct vinsn *vi = &ss->ir->vi[i];
+	struct bpf_insn *insn = &vi->insn.bpf;
+	uint16_t dst = vi->insn.dst, src = vi->insn.src;
+	struct regstate *rs;
+	size_t target;
+	int err, r;
+
+	/* second half of a 64-bit immediate load */
+	if (!insn->code)
+		return 0;
 
-	if (!ir->len)
+	switch (BPF_CLASS(insn->code)) {
+	case BPF_LD:
+		ir_stack_set(ss, dst, RS_NONE, 0);
 		return 0;
-	
-	for (vi = &ir->vi[ir->len - 1]; vi >= ir->vi; vi--) {
-		if (vi->vitype != VI_INSN)
-			continue;
 
-		if (vi->insn.dst & vreg_base) {
-			err = ir_bpf_registerize_one(ir, vi, vi->insn.dst);
+	case BPF_LDX:
+		if (src == BPF_REG_BP) {
+			err = ir_stack_ref(ss, insn->off, i);
 			if (err)
 				return err;
+		} else {
+			ir_stack_use(ss, src, i);
 		}
 
-		if (vi->insn.src & vreg_base) {
-			err = ir_bpf_registerize_one(ir, vi, vi->insn.src);
+		ir_stack_set(ss, dst, RS_NONE, 0);
+		return 0;
+
+	case BPF_STX:
+		if ((src == BPF_REG_BP) || ir_stack_get(ss, src)->kind != RS_NONE)
+			/* stack pointer spilled to memory, we can
+			 * not track it from here on. */
+			return -EINVAL;
+
+		/* fall-through */
+	case BPF_ST:
+		if (dst == BPF_REG_BP)
+			return ir_stack_ref(ss, insn->off, i);
+
+		ir_stack_use(ss, dst, i);
+		return 0;
+
+	case BPF_ALU:
+	case BPF_ALU64:
+		rs = ir_stack_get(ss, dst);
+
+		if (BPF_OP(insn->code) == BPF_MOV) {
+			if (BPF_SRC(insn->code) == BPF_K) {
+				ir_stack_set(ss, dst, RS_NONE, 0);
+			} else if (src == BPF_REG_BP) {
+				ir_stack_set(ss, dst, RS_BP, i);
+			} else {
+				ir_stack_use(ss, src, i);
+				rs = ir_stack_get(ss, src);
+				if (rs->kind == RS_BP)
+					return -EINVAL;
+
+				ir_stack_set(ss, dst, rs->kind, rs->slot);
+			}
+			return 0;
+		}
+
+		if (rs->kind == RS_BP) {
+			if ((insn->code != (BPF_ALU64 | BPF_ADD | BPF_K)))
+				return -EINVAL;
+
+			err = ir_stack_ref(ss, insn->imm, i);
 			if (err)
 				return err;
+
+			/* remember the mov from bp, in case the
+			 * base has to be changed */
+			ss->base[i] = rs->slot + 1;
+			ir_stack_set(ss, dst, RS_PTR, ss->ref[i]);
+			return 0;
+		}
+
+		if (BPF_SRC(insn->code) == BPF_X) {
+			if (src == BPF_REG_BP)
+				return -EINVAL;
+
+			ir_stack_use(ss, src, i);
+
+			rs = ir_stack_get(ss, src);
+			if (rs->kind == RS_PTR
+			    && ir_stack_get(ss, dst)->kind == RS_NONE)
+				ir_stack_set(ss, dst, rs->kind, rs->slot);
+		}
+
+		ir_stack_use(ss, dst, i);
+		return 0;
+
+	case BPF_JMP:
+		switch (BPF_OP(insn->code)) {
+		case BPF_CALL:
+			for (r = BPF_REG_1; r <= BPF_REG_5; r++)
+				ir_stack_use(ss, r, i);
+			for (r = BPF_REG_0; r <= BPF_REG_5; r++)
+				ir_stack_set(ss, r, RS_NONE, 0);
+			return 0;
+
+		case BPF_EXIT:
+			*dead = 1;
+			return 0;
+
+		case BPF_JA:
+			*dead = 1;
+			break;
+
+		default:
+			ir_stack_use(ss, dst, i);
+			if (BPF_SRC(insn->code) == BPF_X)
+				ir_stack_use(ss, src, i);
+			break;
 		}
+
+		err = ir_stack_target(ss, i, n, insn->off, &target);
+		if (err)
+			return err;
+
+		ir_stack_branch(ss, target);
+		return 0;
 	}
-	return err;
+
+	return -EINVAL;
 }
 
-static int ir_bpf_jmp_resolve_one(struct ir *ir, struct vinsn *jmp)
+static int ir_stack_scan(struct slotscan *ss)
 {
+	struct ir *ir = ss->ir;
 	struct vinsn *vi;
-	int off = 0;
+	size_t i, n;
+	int dead = 0, err;
+
+	for (i = 0, n = 0; i < ir->len; i++) {
+		vi = &ir->vi[i];
 
-	for (vi = jmp + 1; vi <= &ir->vi[ir->len - 1]; vi++) {
 		switch (vi->vitype) {
 		case VI_INSN:
 		case VI_LDMAP:
-			off++;
+			ss->insn_vi[n++] = i + 1;
 			break;
 		case VI_LABEL:
-			if (vi->label != jmp->insn.bpf.off)
-				break;
-
-			jmp->insn.bpf.off = off;
-			return 0;
+			ss->label_vi[-vi->label] = i + 1;
+			break;
 		default:
 			break;
 		}
 	}
 
-	return -ENOENT;
-}
+	for (i = 0, n = 0; i < ir->len; i++) {
+		vi = &ir->vi[i];
 
-static int ir_bpf_jmp_resolve(struct ir *ir)
-{
-	struct vinsn *vi;
-	int err;
+		if (dead) {
+			ir_stack_kill(ss);
+			dead = 0;
+		}
 
-	for (vi = ir->vi; vi <= &ir->vi[ir->len - 1]; vi++) {
-		if (vi->vitype != VI_INSN)
-			continue;
+		err = ir_stack_merge(ss, i);
+		if (err)
+			return err;
 
-		if ((BPF_CLASS(vi->insn.bpf.code) == BPF_JMP)
-		    && (vi->insn.bpf.off < 0)) {
-			err = ir_bpf_jmp_resolve_one(ir, vi);
+		switch (vi->vitype) {
+		case VI_INSN:
+			err = ir_stack_scan_insn(ss, i, n++, &dead);
 			if (err)
 				return err;
+			break;
+		case VI_LDMAP:
+			ir_stack_set(ss, vi->map.reg, RS_NONE, 0);
+			n++;
+			break;
+		default:
+			break;
 		}
 	}
 
 	return 0;
 }
 
-int ir_bpf_generate(struct ir *ir)
+static ssize_t ir_stack_align(struct irslot *s, ssize_t c)
+{
+	/* code generation picks access widths based on the alignment
+	 * of the original offsets, and the verifier does not accept
+	 * misaligned stack accesses. so make sure that the new offset
+	 * is congruent with the old one modulo the largest access
+	 * width. */
+	return c - (((c - s->stack) % 8 + 8) % 8);
+}
+
+static ssize_t ir_stack_color(struct slotscan *ss, ssize_t *color, int scratch)
+{
+	struct ir *ir = ss->ir;
+	struct irslot *s, *t;
+	size_t *order, n = 0, i, j, k;
+	ssize_t c, sp = 0;
+
+	order = xcalloc(ir->n_slots ? : 1, sizeof(*order));
+
+	/* place slots in order of their first use, dead slots are
+	 * not placed at all */
+	for (i = 0; i < ir->n_slots; i++) {
+		if ((ss->first[i] < 0) || (ss->scratch[i] != scratch))
+			continue;
+
+		for (j = n; j && ss->first[order[j - 1]] > ss->first[i]; j--)
+			order[j] = order[j - 1];
+
+		order[j] = i;
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		s = &ir->slots[order[i]];
+		c = ir_stack_align(s, -(ssize_t)s->size);
+
+	again:
+		for (j = 0; j < i; j++) {
+			k = order[j];
+			t = &ir->slots[k];
+
+			if (ss->last[k] < ss->first[order[i]])
+				continue;
+
+			if ((c + (ssize_t)s->size <= color[k])
+			    || (c >= color[k] + (ssize_t)t->size))
+				continue;
+
+			c = ir_stack_align(s, color[k] - (ssize_t)s->size);
+			goto again;
+		}
+
+		color[order[i]] = c;
+		if (c < sp)
+			sp = c;
+	}
+
+	free(order);
+	return sp;
+}
+
+static void ir_stack_rewrite(struct slotscan *ss, ssize_t *color)
+{
+	struct ir *ir = ss->ir;
+	struct vinsn *vi;
+	struct bpf_insn *insn;
+	ssize_t delta;
+	size_t i;
+	int slot;
+
+	for (i = 0; i < ir->len; i++) {
+		slot = ss->ref[i];
+		if (slot < 0)
+			continue;
+
+		vi = &ir->vi[i];
+		insn = &vi->insn.bpf;
+		delta = color[slot] - ir->slots[slot].stack;
+
+		if (BPF_CLASS(insn->code) == BPF_ALU64)
+			insn->imm += delta;
+		else
+			insn->off += delta;
+
+		if (!ss->scratch[slot])
+			continue;
+
+		/* rebase the access on the scratch map */
+		switch (BPF_CLASS(insn->code)) {
+		case BPF_ALU64:
+			ir->vi[ss->base[i] - 1].insn.src = BPF_REG_SCRATCH;
+			break;
+		case BPF_LDX:
+			vi->insn.src = BPF_REG_SCRATCH;
+			break;
+		default:
+			vi->insn.dst = BPF_REG_SCRATCH;
+			break;
+		}
+	}
+}
+
+static void ir_stack_free(struct slotscan *ss)
+{
+	free(ss->scratch);
+	free(ss->last);
+	free(ss->first);
+	free(ss->base);
+	free(ss->ref);
+	free(ss->label_vi);
+	free(ss->insn_vi);
+	free(ss->pend_head);
+	free(ss->pend);
+	free(ss->active);
+	free(ss->regs);
+}
+
+static int ir_stack_analyze(struct slotscan *ss, struct ir *ir)
+{
+	size_t i;
+
+	memset(ss, 0, sizeof(*ss));
+	ss->ir = ir;
+
+	ss->n_regs = BPF_REG_BP + 1 + (ir->next_reg - vreg_base);
+	ss->regs = xcalloc(ss->n_regs, sizeof(*ss->regs));
+	ss->active = xcalloc(ss->n_regs, sizeof(*ss->active));
+	ss->pend_head = xcalloc(ir->len, sizeof(*ss->pend_head));
+	ss->insn_vi = xcalloc(ir->len, sizeof(*ss->insn_vi));
+	ss->n_labels = -ir->next_label;
+	ss->label_vi = xcalloc(ss->n_labels, sizeof(*ss->label_vi));
+	ss->ref = xcalloc(ir->len, sizeof(*ss->ref));
+	ss->base = xcalloc(ir->len, sizeof(*ss->base));
+	ss->first = xcalloc(ir->n_slots, sizeof(*ss->first));
+	ss->last = xcalloc(ir->n_slots, sizeof(*ss->last));
+	ss->scratch = xcalloc(ir->n_slots, sizeof(*ss->scratch));
+
+	for (i = 0; i < ir->len; i++)
+		ss->ref[i] = -1;
+	for (i = 0; i < ir->n_slots; i++)
+		ss->first[i] = ss->last[i] = -1;
+
+	return ir_stack_scan(ss);
+}
+
+ssize_t ir_bpf_stack_usage(struct ir *ir)
+{
+	struct slotscan ss;
+	ssize_t *color, sp = ir->sp;
+
+	if (!ir->n_slots)
+		return 0;
+
+	color = xcalloc(ir->n_slots, sizeof(*color));
+
+	if (!ir_stack_analyze(&ss, ir))
+		sp = ir_stack_color(&ss, color, 0);
+
+	ir_stack_free(&ss);
+	free(color);
+	return -sp;
+}
+
+static void ir_bpf_scratch_prologue(struct ir *ir)
+{
+	struct ir pro = { 0 };
+
+	/* r9 = map_lookup_elem(scratch, &(u32){ 0 }), r1 (the
+	 * context) is preserved. */
+	ir_emit_comment(&pro, "scratch");
+	ir_emit_insn(&pro, ST_IMM(BPF_W, -4, 0), BPF_REG_BP, 0);
+	ir_emit_insn(&pro, MOV64, BPF_REG_SCRATCH, BPF_REG_1);
+	ir_emit_ldmap(&pro, BPF_REG_1, ir->scratch);
+	ir_emit_ldbp(&pro, BPF_REG_2, -4);
+	ir_emit_insn(&pro, CALL(BPF_FUNC_map_lookup_elem), 0, 0);
+	ir_emit_insn(&pro, MOV64, BPF_REG_1, BPF_REG_SCRATCH);
+	ir_emit_insn(&pro, JMP_IMM(BPF_JNE, 0, 1), BPF_REG_0, 0);
+	ir_emit_insn(&pro, EXIT, 0, 0);
+	ir_emit_insn(&pro, MOV64, BPF_REG_SCRATCH, BPF_REG_0);
+
+	ir->size = ir->len + pro.len;
+	ir->vi = realloc(ir->vi, ir->size * sizeof(*ir->vi));
+	assert(ir->vi);
+
+	memmove(&ir->vi[pro.len], ir->vi, ir->len * sizeof(*ir->vi));
+	memcpy(ir->vi, pro.vi, pro.len * sizeof(*ir->vi));
+	ir->len += pro.len;
+	free(pro.vi);
+
+	if (ir->sp > -4)
+		ir->sp = -4;
+}
+
+static int ir_bpf_stack_alloc(struct ir *ir)
+{
+	struct slotscan ss;
+	ssize_t *color, sp;
+	size_t i, big;
+	int err;
+
+	if (!ir->n_slots)
+		return 0;
+
+	color = xcalloc(ir->n_slots, sizeof(*color));
+
+	err = ir_stack_analyze(&ss, ir);
+	if (err) {
+		_d("ir_bpf_generate: unable to track stack usage, "
+		   "keeping original layout\n");
+		err = 0;
+		goto out;
+	}
+
+	ir->sp = ir_stack_color(&ss, color, 0);
+
+	/* if we're still above the limit, move the largest slots
+	 * over to the scratch map until the rest fits. */
+	while (ir->scratch && (-ir->sp > MAX_BPF_STACK)) {
+		for (i = 0, big = ir->n_slots; i < ir->n_slots; i++) {
+			if ((ss.first[i] < 0) || ss.scratch[i])
+				continue;
+
+			if ((big == ir->n_slots)
+			    || (ir->slots[i].size > ir->slots[big].size))
+				big = i;
+		}
+
+		if (big == ir->n_slots)
+			break;
+
+		ss.scratch[big] = 1;
+		ir->sp = ir_stack_color(&ss, color, 0);
+	}
+
+	sp = ir_stack_color(&ss, color, 1);
+	if (sp) {
+		ir->scratch_size = (-sp + 7) & ~7;
+		if (ir->scratch_size > IR_SCRATCH_MAX) {
+			_e("temporaries require %zu bytes of scratch space, "
+			   "the maximum is %d\n", ir->scratch_size,
+			   IR_SCRATCH_MAX);
+			err = -E2BIG;
+			goto out;
+		}
+
+		for (i = 0; i < ir->n_slots; i++) {
+			if (ss.scratch[i])
+				color[i] += ir->scratch_size;
+		}
+	}
+
+	ir_stack_rewrite(&ss, color);
+
+	if (ir->scratch_size)
+		ir_bpf_scratch_prologue(ir);
+
+out:
+	ir_stack_free(&ss);
+	free(color);
+	return err;
+}
+
+
+static void ir_bpf_vreg_replace(struct ir *ir, struct vinsn *last,
+				uint16_t vreg, int reg)
+{
+	struct vinsn *vi;
+
+	_d("ir_bpf_generate: v%d -> r%d\n", vreg & ~vreg_base, reg);
+
+	for (vi = ir->vi; vi <= last; vi++) {
+		if (vi->vitype != VI_INSN)
+			continue;
+
+		if (vi->insn.dst == vreg)
+			vi->insn.dst = reg;
+		if (vi->insn.src == vreg)
+			vi->insn.src = reg;
+	}	
+}
+
+
+static int ir_bpf_registerize_one(struct ir *ir, struct vinsn *last,
+				  uint16_t vreg)
+{
+	struct vinsn *vi;
+	uint16_t clean = 0x3ff;
+
+	for (vi = ir->vi; clean && (vi < last); vi++) {
+		if (vi->vitype != VI_INSN)
+			continue;
+
+		if (!(vi->insn.src & vreg_base))
+			clean &= ~(1 << vi->insn.src);
+		if (!(vi->insn.dst & vreg_base))
+			clean &= ~(1 << vi->insn.dst);
+		if ((BPF_CLASS(vi->insn.bpf.code) == BPF_JMP)
+		    && (BPF_OP(vi->insn.bpf.code) == BPF_CALL))
+			clean &= ~BPF_REG_CALLER_SAVE;
+	}
+
+	if (clean) {
+		int reg;
+
+		for (reg = BPF_REG_0; !(clean & 1); clean >>= 1, reg++);
+
+		ir_bpf_vreg_replace(ir, last, vreg, reg);
+		return 0;
+	}
+
+	/* TODO ir_bpf_vreg_spill(ir, last); */
+	return -1;
+}
+
+static int ir_bpf_registerize(struct ir *ir)
+{
+	struct vinsn *vi;
+	int err = 0;
+
+	if (!ir->len)
+		return 0;
+	
+	for (vi = &ir->vi[ir->len - 1]; vi >= ir->vi; vi--) {
+		if (vi->vitype != VI_INSN)
+			continue;
+
+		if (vi->insn.dst & vreg_base) {
+			err = ir_bpf_registerize_one(ir, vi, vi->insn.dst);
+			if (err)
+				return err;
+		}
+
+		if (vi->insn.src & vreg_base) {
+			err = ir_bpf_registerize_one(ir, vi, vi->insn.src);
+			if (err)
+				return err;
+		}
+	}
+	return err;
+}
+
+static int ir_bpf_jmp_resolve(struct ir *ir)
+{
+	struct vinsn *vi;
+	int *labels, n_labels, label, off = 0;
+	int err = 0;
+
+	if (!ir->len)
+		return 0;
+
+	/* labels are allocated downwards from -1, so -label can be
+	 * used to index a table of instruction offsets. entries are
+	 * biased by one so that zero means "not yet seen". */
+	n_labels = -ir->next_label;
+	labels = xcalloc(n_labels, sizeof(*labels));
+
+	for (vi = ir->vi; vi <= &ir->vi[ir->len - 1]; vi++) {
+		switch (vi->vitype) {
+		case VI_INSN:
+		case VI_LDMAP:
+			off++;
+			break;
+		case VI_LABEL:
+			assert(-vi->label < n_labels);
+			labels[-vi->label] = off + 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	off = 0;
+	for (vi = ir->vi; vi <= &ir->vi[ir->len - 1]; vi++) {
+		switch (vi->vitype) {
+		case VI_INSN:
+			off++;
+			break;
+		case VI_LDMAP:
+			off++;
+			continue;
+		default:
+			continue;
+		}
+
+		if (vinsn_is_subprog_call(vi)) {
+			label = -vi->insn.bpf.imm;
+
+			/* subprograms are always placed last */
+			if ((label >= n_labels) || (labels[label] - 1 < off)) {
+				err = -ENOENT;
+				break;
+			}
+
+			vi->insn.bpf.imm = labels[label] - 1 - off;
+			continue;
+		}
+
+		if ((BPF_CLASS(vi->insn.bpf.code) != BPF_JMP)
+		    || (vi->insn.bpf.off >= 0))
+			continue;
+
+		label = -vi->insn.bpf.off;
+
+		/* only forward jumps are allowed */
+		if ((label >= n_labels) || (labels[label] - 1 < off)) {
+			err = -ENOENT;
+			break;
+		}
+
+		vi->insn.bpf.off = labels[label] - 1 - off;
+	}
+
+	free(labels);
+	return err;
+}
+
+static void ir_bpf_subprog_inline(struct ir *ir, struct ir_subcall *sub)
+{
+	struct ir body = { .next_label = ir->next_label };
+	struct vinsn *vi;
+	size_t at, len;
+
+	for (vi = ir->vi; !vinsn_is_subprog_call(vi)
+		     || (vi->insn.bpf.imm != sub->label); vi++);
+
+	at = vi - ir->vi;
+
+	sub->sp->emit(&body);
+	ir->next_label = body.next_label;
+
+	/* replace the call with the body */
+	len = ir->len - 1 + body.len;
+	if (len > ir->size) {
+		ir->size = len;
+		ir->vi = realloc(ir->vi, ir->size * sizeof(*ir->vi));
+		assert(ir->vi);
+	}
+
+	memmove(&ir->vi[at + body.len], &ir->vi[at + 1],
+		(ir->len - at - 1) * sizeof(*ir->vi));
+	memcpy(&ir->vi[at], body.vi, body.len * sizeof(*ir->vi));
+	ir->len = len;
+	free(body.vi);
+}
+
+static void ir_bpf_subprogs(struct ir *ir)
+{
+	struct ir_subcall *sub;
+
+	for (sub = ir->subs; sub < &ir->subs[ir->n_subs]; sub++) {
+		/* a call only pays off if the code is shared */
+		if (sub->calls == 1) {
+			ir_bpf_subprog_inline(ir, sub);
+			continue;
+		}
+
+		ir_emit_comment(ir, sub->sp->name);
+		ir_emit_label(ir, sub->label);
+		sub->sp->emit(ir);
+		ir_emit_insn(ir, EXIT, 0, 0);
+	}
+}
+
+int ir_bpf_generate(struct ir *ir)
 {
 	int err;
 
+	/* subprograms are placed after the main program, before any
+	 * other pass sees it. */
+	ir_bpf_subprogs(ir);
+
+	err = ir_bpf_stack_alloc(ir);
+	if (err)
+		return err;
+
 	err = ir_bpf_registerize(ir);
 	if (err)
 		return err;
@@ -719,27 +1662,41 @@ int ir_bpf_generate(struct ir *ir)
  * comments. */
 int ir_bpf_extract(struct ir *ir, struct bpf_insn **insnsp, int *n_insnsp)
 {
-	struct bpf_insn *insns = NULL;
+	struct bpf_insn *insns;
 	struct vinsn *vi;
 	int n_insns = 0;
 
-	for (vi = ir->vi; vi <= &ir->vi[ir->len - 1]; vi++) {
+	for (vi = ir->vi; vi < &ir->vi[ir->len]; vi++) {
 		switch (vi->vitype) {
 		case VI_INSN:
-			insns = realloc(insns, (n_insns + 1) * sizeof(*insns));
-			insns[n_insns] = vi->insn.bpf;
-			insns[n_insns].dst_reg = vi->insn.dst;
-			insns[n_insns].src_reg = vi->insn.src;
+		case VI_LDMAP:
 			n_insns++;
 			break;
+		case VI_LABEL:
+		case VI_COMMENT:
+			break;
+		}
+	}
+
+	insns = xcalloc(n_insns ? : 1, sizeof(*insns));
+	*insnsp = insns;
+	*n_insnsp = n_insns;
+
+	for (vi = ir->vi; vi < &ir->vi[ir->len]; vi++) {
+		switch (vi->vitype) {
+		case VI_INSN:
+			*insns = vi->insn.bpf;
+			insns->dst_reg = vi->insn.dst;
+			insns->src_reg = vi->insn.src;
+			insns++;
+			break;
 		case VI_LDMAP:
 			assert(vi->map.sym->mapfd >= 0);
 
-			insns = realloc(insns, (n_insns + 1) * sizeof(*insns));
-			insns[n_insns] = LDDW_IMM(vi->map.sym->mapfd);
-			insns[n_insns].dst_reg = vi->map.reg;
-			insns[n_insns].src_reg = BPF_PSEUDO_MAP_FD;
-			n_insns++;
+			*insns = LDDW_IMM(vi->map.sym->mapfd);
+			insns->dst_reg = vi->map.reg;
+			insns->src_reg = BPF_PSEUDO_MAP_FD;
+			insns++;
 			break;
 
 		case VI_LABEL:
@@ -748,8 +1705,260 @@ int ir_bpf_extract(struct ir *ir, struct bpf_insn **insnsp, int *n_insnsp)
 		}
 	}
 
-	*insnsp = insns;
-	*n_insnsp = n_insns;
 	return 0;
-	
+}
+
+/* Serialization of generated programs, used by the program cache.
+ *
+ * Map references are stored by name and resolved through `sym_fn`
+ * when read back, all other instructions are stored verbatim. */
+
+uint64_t ir_hash(struct ir *ir, uint64_t h)
+{
+	struct ir_subcall *sub;
+	struct vinsn *vi;
+
+	for (vi = ir->vi; vi < &ir->vi[ir->len]; vi++) {
+		h = cache_hash(h, &vi->vitype, sizeof(vi->vitype));
+
+		switch (vi->vitype) {
+		case VI_INSN:
+			h = cache_hash(h, &vi->insn, sizeof(vi->insn));
+			break;
+		case VI_LDMAP:
+			h = cache_hash(h, &vi->map.reg, sizeof(vi->map.reg));
+			h = cache_hash(h, vi->map.sym->name ? : "",
+				       strlen(vi->map.sym->name ? : "") + 1);
+			break;
+		case VI_LABEL:
+			h = cache_hash(h, &vi->label, sizeof(vi->label));
+			break;
+		case VI_COMMENT:
+			h = cache_hash(h, vi->comment, strlen(vi->comment) + 1);
+			break;
+		}
+	}
+
+	/* calls only reference a label, the subprogram behind it is
+	 * not emitted until ir_bpf_generate. */
+	for (sub = ir->subs; sub < &ir->subs[ir->n_subs]; sub++) {
+		h = cache_hash(h, sub->sp->name, strlen(sub->sp->name) + 1);
+		h = cache_hash(h, &sub->label, sizeof(sub->label));
+	}
+
+	h = cache_hash(h, ir->slots, ir->n_slots * sizeof(*ir->slots));
+	h = cache_hash(h, &ir->sp, sizeof(ir->sp));
+	h = cache_hash(h, &ir->next_reg, sizeof(ir->next_reg));
+	h = cache_hash(h, &ir->next_label, sizeof(ir->next_label));
+	return h;
+}
+
+struct ir_fhdr {
+	uint64_t len;
+	int64_t sp;
+	uint64_t scratch_size;
+};
+
+static int ir_fwrite_str(FILE *fp, const char *str)
+{
+	uint32_t len = str ? strlen(str) : 0;
+
+	if (!fwrite(&len, sizeof(len), 1, fp))
+		return -EIO;
+
+	if (len && !fwrite(str, len, 1, fp))
+		return -EIO;
+
+	return 0;
+}
+
+static char *ir_fread_str(FILE *fp)
+{
+	uint32_t len;
+	char *str;
+
+	if (!fread(&len, sizeof(len), 1, fp) || (len > 0x10000))
+		return NULL;
+
+	str = xcalloc(1, len + 1);
+	if (len && !fread(str, len, 1, fp)) {
+		free(str);
+		return NULL;
+	}
+
+	return str;
+}
+
+int ir_fwrite(struct ir *ir, FILE *fp)
+{
+	struct ir_fhdr hdr = {
+		.len = ir->len,
+		.sp = ir->sp,
+		.scratch_size = ir->scratch_size,
+	};
+	struct vinsn *vi;
+	uint8_t vitype;
+	int err;
+
+	if (!fwrite(&hdr, sizeof(hdr), 1, fp))
+		return -EIO;
+
+	err = ir_fwrite_str(fp, ir->scratch ? ir->scratch->name : NULL);
+	if (err)
+		return err;
+
+	for (vi = ir->vi; !err && (vi < &ir->vi[ir->len]); vi++) {
+		vitype = vi->vitype;
+		if (!fwrite(&vitype, sizeof(vitype), 1, fp))
+			return -EIO;
+
+		switch (vi->vitype) {
+		case VI_INSN:
+			err = fwrite(&vi->insn, sizeof(vi->insn), 1, fp) ?
+				0 : -EIO;
+			break;
+		case VI_LDMAP:
+			if (!vi->map.sym->name)
+				return -EINVAL;
+
+			err = fwrite(&vi->map.reg, sizeof(vi->map.reg), 1, fp) ?
+				0 : -EIO;
+			err = err ? : ir_fwrite_str(fp, vi->map.sym->name);
+			break;
+		case VI_LABEL:
+			err = fwrite(&vi->label, sizeof(vi->label), 1, fp) ?
+				0 : -EIO;
+			break;
+		case VI_COMMENT:
+			err = ir_fwrite_str(fp, vi->comment);
+			break;
+		}
+	}
+
+	return err;
+}
+
+static int ir_fread_vinsn(struct vinsn *vi, FILE *fp)
+{
+	uint8_t vitype;
+	char *str;
+
+	if (!fread(&vitype, sizeof(vitype), 1, fp))
+		return -EIO;
+
+	vi->vitype = vitype;
+
+	switch (vi->vitype) {
+	case VI_INSN:
+		return fread(&vi->insn, sizeof(vi->insn), 1, fp) ? 0 : -EIO;
+	case VI_LDMAP:
+		if (!fread(&vi->map.reg, sizeof(vi->map.reg), 1, fp))
+			return -EIO;
+
+		/* the name is stashed in place of the symbol until
+		 * the whole program has been read. */
+		vi->map.sym = (void *)ir_fread_str(fp);
+		return vi->map.sym ? 0 : -EIO;
+	case VI_LABEL:
+		return fread(&vi->label, sizeof(vi->label), 1, fp) ? 0 : -EIO;
+	case VI_COMMENT:
+		str = ir_fread_str(fp);
+		if (!str)
+			return -EIO;
+
+		/* comments live as long as the program, like the
+		 * ones emitted by the compiler. */
+		vi->comment = astrdup(str);
+		free(str);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static void ir_fread_free(struct vinsn *vis, size_t len)
+{
+	struct vinsn *vi;
+
+	for (vi = vis; vi < &vis[len]; vi++) {
+		switch (vi->vitype) {
+		case VI_LDMAP:
+			free(vi->map.sym);
+			break;
+		default:
+			break;
+		}
+	}
+
+	free(vis);
+}
+
+int ir_fread(struct ir *ir, FILE *fp, ir_sym_fn sym_fn, void *priv)
+{
+	struct sym *scratch = NULL;
+	struct vinsn *vis, *vi;
+	struct ir_fhdr hdr;
+	char *scratch_name;
+	size_t n = 0;
+	int err = -EIO;
+
+	if (!fread(&hdr, sizeof(hdr), 1, fp) || !hdr.len
+	    || (hdr.len > 0x1000000))
+		return -EIO;
+
+	scratch_name = ir_fread_str(fp);
+	if (!scratch_name)
+		return -EIO;
+
+	vis = xcalloc(hdr.len, sizeof(*vis));
+	for (n = 0; n < hdr.len; n++) {
+		err = ir_fread_vinsn(&vis[n], fp);
+		if (err)
+			goto err_free;
+	}
+
+	/* resolve regular maps first, the scratch area is created on
+	 * demand and should not be if we end up discarding this
+	 * program. */
+	err = -ENOENT;
+	for (vi = vis; vi < &vis[n]; vi++) {
+		if ((vi->vitype != VI_LDMAP)
+		    || !strcmp((char *)vi->map.sym, scratch_name))
+			continue;
+
+		if (!sym_fn((char *)vi->map.sym, priv))
+			goto err_free;
+	}
+
+	if (scratch_name[0]) {
+		scratch = sym_fn(scratch_name, priv);
+		if (!scratch)
+			goto err_free;
+	}
+
+	for (vi = vis; vi < &vis[n]; vi++) {
+		char *name = (char *)vi->map.sym;
+
+		if (vi->vitype != VI_LDMAP)
+			continue;
+
+		vi->map.sym = scratch_name[0] && !strcmp(name, scratch_name) ?
+			scratch : sym_fn(name, priv);
+		free(name);
+	}
+
+	free(scratch_name);
+
+	free(ir->vi);
+	ir->vi = vis;
+	ir->len = ir->size = n;
+	ir->sp = hdr.sp;
+	ir->scratch = scratch;
+	ir->scratch_size = hdr.scratch_size;
+	return 0;
+
+err_free:
+	ir_fread_free(vis, n);
+	free(scratch_name);
+	return err;
 }
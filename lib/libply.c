@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <ply/internal.h>
 #include <ply/ply.h>
@@ -23,10 +24,11 @@ struct ply_config ply_config = {
 
 	.sort = 1,
 	.ksyms = 1,
+	.cache = 1,
 	.strict = 1,
 };
 
-static void ply_map_print(struct ply *ply, struct sym *sym)
+void ply_map_print(struct sym *sym)
 {
 	struct type *t = sym->type;
 	size_t key_size, val_size, row_size, n_elems;
@@ -74,6 +76,34 @@ err_free:
 	free(data);
 }
 
+void ply_map_clear(struct sym *sym)
+{
+	char *key;
+
+	key = xcalloc(1, type_sizeof(sym->type->map.ktype));
+
+	/* the first key is always a fresh one, since the previous one
+	 * was just deleted. */
+	while (!bpf_map_next(sym->mapfd, NULL, key)) {
+		if (bpf_map_delete(sym->mapfd, key))
+			break;
+	}
+
+	free(key);
+}
+
+static int ply_sym_is_scratch(struct ply *ply, struct sym *sym)
+{
+	struct ply_probe *pb;
+
+	ply_probe_foreach(ply, pb) {
+		if (pb->ir->scratch == sym)
+			return 1;
+	}
+
+	return 0;
+}
+
 void ply_maps_print(struct ply *ply)
 {
 	struct sym **symp, *sym;
@@ -83,15 +113,16 @@ void ply_maps_print(struct ply *ply)
 
 		if (sym->type->ttype == T_MAP
 		    && sym->type->map.mtype != BPF_MAP_TYPE_PERF_EVENT_ARRAY
-		    && sym->type->map.mtype != BPF_MAP_TYPE_STACK_TRACE)
-			ply_map_print(ply, sym);
+		    && sym->type->map.mtype != BPF_MAP_TYPE_STACK_TRACE
+		    && !ply_sym_is_scratch(ply, sym))
+			ply_map_print(sym);
 	}	
 }
 
 void ply_probe_free(struct ply *ply, struct ply_probe *pb)
 {
-	/* TODO */
-	free(pb);
+	/* everything else is in the arena. */
+	ir_free(pb->ir);
 }
 
 int __ply_probe_alloc(struct ply *ply, struct node *pspec, struct node *ast)
@@ -99,19 +130,17 @@ int __ply_probe_alloc(struct ply *ply, struct node *pspec, struct node *ast)
 	struct ply_probe *pb, *last;
 	int err;
 
-	pb = xcalloc(1, sizeof(*pb));
+	pb = acalloc(1, sizeof(*pb));
 
 	pb->ply = ply;
 	pb->ast = ast;
-	pb->probe = strdup(pspec->string.data);
-	free(pspec);
-	
+	pb->probe = pspec->string.data;
+
 	pb->provider = provider_get(pb->probe);
 	if (!pb->provider) {
 		_e("%#N: no provider found for %N.\n",
 		   ast->expr.args, ast->expr.args);
-		err = -EINVAL;
-		goto err_free_probe;
+		return -EINVAL;
 	}
 
 	pb->ir = ir_new();
@@ -131,26 +160,28 @@ int __ply_probe_alloc(struct ply *ply, struct node *pspec, struct node *ast)
 	return 0;
 
 err_free_ir:
-	free(pb->ir);
-err_free_probe:
-	free(pb->probe);
-	free(pb);
+	ir_free(pb->ir);
 	return err;
 }
 
 int ply_fparse(struct ply *ply, FILE *fp)
 {
+	struct arena *prev;
 	yyscan_t scanner;
+	int err = 0;
 	
 	if (yylex_init(&scanner))
 		return -EINVAL;
 
+	prev = arena_enter(&ply->arena);
+
 	yyset_in(fp, scanner);
 	if (yyparse(scanner, ply))
-		return -EINVAL;
- 
+		err = -EINVAL;
+
+	arena_leave(prev);
 	yylex_destroy(scanner); 
-	return 0;
+	return err;
 }
 
 int ply_parsef(struct ply *ply, const char *fmt, ...)
@@ -208,12 +239,18 @@ static int ply_unload_detach(struct ply *ply)
 	struct ply_probe *pb;
 	int err;
 
+	if (ply->detached)
+		return 0;
+
+	ply->detached = 1;
 	ply_probe_foreach(ply, pb) {
 		err = pb->provider->detach(pb);
 		if (err)
 			return err;
 	}
 
+	/* the events were closed by the providers. */
+	ply->n_evfds = 0;
 	return 0;
 }
 
@@ -263,30 +300,70 @@ static int ply_load_map(struct ply *ply)
 	return 0;
 }
 
+/* the verifier always ends its log with a summary line, starting with
+ * "processed N insns". */
+static void ply_probe_verified(struct ply_probe *pb)
+{
+	const char *line;
+
+	line = strstr(bpf_log_buf, "processed ");
+	if (!line || (sscanf(line, "processed %u insns",
+			     &pb->verified_insns) != 1))
+		pb->verified_insns = 0;
+}
+
+int ply_probe_load(struct ply_probe *pb)
+{
+	struct bpf_insn *insns;
+	int err, n_insns;
+
+	err = ir_bpf_extract(pb->ir, &insns, &n_insns);
+	if (err)
+		return err;
+
+	pb->bpf_fd = bpf_prog_load(pb->provider->prog_type, pb->attach_type,
+				   pb->attach_btf_id, insns, n_insns);
+	free(insns);
+	if (pb->bpf_fd < 0) {
+		_e("unable to load %s, errno:%d\n", pb->probe, errno);
+		if ((errno == EINVAL) && !bpf_log_buf[0])
+			_w("was ply built against the running kernel?\n");
+		else
+			_e("output from kernel bpf verifier:\n%s\n", bpf_log_buf);
+
+		return -errno;
+	}
+
+	ply_probe_verified(pb);
+	return 0;
+}
+
 static int ply_load_bpf(struct ply *ply)
 {
 	struct ply_probe *pb;
 	int err;
 
 	ply_probe_foreach(ply, pb) {
-		struct bpf_insn *insns;
-		int n_insns;
-
-		err = ir_bpf_extract(pb->ir, &insns, &n_insns);
+		err = ply_probe_load(pb);
 		if (err)
 			return err;
+	}
 
-		pb->bpf_fd = bpf_prog_load(pb->provider->prog_type, insns, n_insns);
-		free(insns);
-		if (pb->bpf_fd < 0) {
-			_e("unable to load %s, errno:%d\n", pb->probe, errno);
-			if ((errno == EINVAL) && !bpf_log_buf[0])
-				_w("was ply built against the running kernel?\n");
-			else
-				_e("output from kernel bpf verifier:\n%s\n", bpf_log_buf);
+	return 0;
+}
 
-			return -errno;
-		}
+static int ply_load_start(struct ply *ply)
+{
+	struct ply_probe *pb;
+	int err;
+
+	ply_probe_foreach(ply, pb) {
+		if (!pb->provider->start)
+			continue;
+
+		err = pb->provider->start(pb);
+		if (err)
+			return err;
 	}
 
 	return 0;
@@ -321,6 +398,12 @@ int ply_load(struct ply *ply)
 	if (err)
 		goto err_free_map;
 
+	/* BEGIN probes and the like must be done before any other
+	 * probe can see the state they set up. */
+	err = ply_load_start(ply);
+	if (err)
+		goto err_free_prog;
+
 	err = ply_load_attach(ply);
 	if (err)
 		goto err_free_prog;
@@ -347,14 +430,88 @@ struct ply_return ply_loop(struct ply *ply)
 	return buffer_loop((struct buffer *)ply->stdbuf->priv);
 }
 
+/* the kernel only accounts for the time spent in programs while
+ * someone holds a stats fd open. */
+int ply_stats_enable(struct ply *ply)
+{
+#ifdef LINUX_HAS_BPF_STATS
+	if (ply->stats_fd >= 0)
+		return 0;
+
+	ply->stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+	if (ply->stats_fd < 0)
+		return -errno;
+
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+int ply_probe_runtime(struct ply_probe *pb, uint64_t *ns, uint64_t *cnt)
+{
+#ifdef LINUX_HAS_BPF_STATS
+	struct bpf_prog_info info;
+
+	if (bpf_prog_get_info(pb->bpf_fd, &info))
+		return -errno;
+
+	*ns  = info.run_time_ns;
+	*cnt = info.run_cnt;
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
 int ply_stop(struct ply *ply)
 {
-	return perf_event_disable(ply->group_fd);
+	struct ply_probe *pb;
+	size_t i;
+	int err;
+
+	for (i = 0; i < ply->n_evfds; i++) {
+		err = perf_event_disable(ply->evfds[i]);
+		if (err)
+			return err;
+	}
+
+	/* not every probe is backed by a perf event, e.g. raw
+	 * tracepoints, so detach them all before END probes and the
+	 * like get to look at the maps. */
+	err = ply_unload_detach(ply);
+	if (err)
+		return err;
+
+	ply_probe_foreach(ply, pb) {
+		if (!pb->provider->stop)
+			continue;
+
+		err = pb->provider->stop(pb);
+		if (err)
+			return err;
+	}
+
+	/* output from the stop hooks, e.g. END probes, should not be
+	 * lost just because no one is polling anymore. */
+	if (ply->stdbuf)
+		buffer_drain((struct buffer *)ply->stdbuf->priv);
+
+	return 0;
 }
 
 int ply_start(struct ply *ply)
 {
-	return perf_event_enable(ply->group_fd);
+	size_t i;
+	int err;
+
+	for (i = 0; i < ply->n_evfds; i++) {
+		err = perf_event_enable(ply->evfds[i]);
+		if (err)
+			return err;
+	}
+
+	return 0;
 }
 
 void ply_free(struct ply *ply)
@@ -370,8 +527,17 @@ void ply_free(struct ply *ply)
 	if (ply->ksyms)
 		ksyms_free(ply->ksyms);
 
+	if (ply->btf)
+		btf_free(ply->btf);
+
 	/* TODO: evpipe_free(&ply->evp); */
 
+	if (ply->stats_fd >= 0)
+		close(ply->stats_fd);
+
+	arena_free(&ply->arena);
+	free(ply->evfds);
+	free(ply->group);
 	free(ply);
 }
 
@@ -386,7 +552,7 @@ int ply_alloc(struct ply **plyp)
 
 	ply->globals.global = 1;
 	asprintf(&ply->group, "ply%d", getpid());
-	ply->group_fd = -1;
+	ply->stats_fd = -1;
 
 	if (ply_config.ksyms)
 		ply->ksyms = ksyms_new();
@@ -157,7 +157,7 @@ static struct node *node_new(enum ntype ntype, const struct nloc *loc)
 {
 	struct node *n;
 
-	n = xcalloc(1, sizeof(*n));
+	n = acalloc(1, sizeof(*n));
 	n->ntype = ntype;
 
 	if (loc)
@@ -184,29 +184,27 @@ void __string_escape(char *dst, const char *src)
 			*dst++ = *src++;
 		}
 	}
+
+	*dst = '\0';
 }
 
-struct node *node_string(const struct nloc *loc, char *data)
+struct node *node_string(const struct nloc *loc, const char *data)
 {
 	struct node *n = node_new(N_STRING, loc);
-	size_t len;
+	size_t len = strlen(data);
 
 	/* remove quotes */
 	if (data[0] == '"') {
-		char *unquoted;
-
-		len = strlen(data) - 2;
-
-		unquoted = xcalloc(1, len + 1);
-		strncpy(unquoted, data + 1, len);
-		free(data);
-		data = unquoted;
+		data++;
+		len -= 2;
 	}
 
-	len = (strlen(data) + 8) & ~7;
-	n->string.data = xcalloc(1, len);
-	__string_escape(n->string.data, data);
-	free(data);
+	n->string.data = acalloc(1, (len + 8) & ~7);
+	memcpy(n->string.data, data, len);
+
+	/* escaping never makes the string longer, so it can be done
+	 * in place. */
+	__string_escape(n->string.data, n->string.data);
 	return n;
 }
 
@@ -247,6 +245,8 @@ void node_insert(struct node *prev, struct node *n)
 
 	n->prev = prev;
 	n->next = prev->next;
+	if (n->next)
+		n->next->prev = n;
 	prev->next = n;
 }
 
@@ -271,7 +271,10 @@ struct node *node_expr_append(const struct nloc *loc,
 	if (loc)
 		n->loc = *loc;
 
-	arg->up = n;
+	/* arg may be the head of a list of nodes, all of which
+	 * become children of n. */
+	for (last = arg; last; last = last->next)
+		last->up = n;
 
 	if (!n->expr.args) {
 		n->expr.args = arg;
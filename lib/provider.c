@@ -14,18 +14,17 @@
 struct provider *provider_get(const char *name)
 {
 	struct provider *p;
-	char *search;
+	size_t len;
 
-	search = strtok(strdup(name), ":");
+	/* the provider is named by everything up to the first ':',
+	 * which may be any prefix of its full name. */
+	name += strspn(name, ":");
+	len = strcspn(name, ":");
 
 	for (p = &__start_providers; p < &__stop_providers; p++) {
- 		if (strstr(p->name, search) == p->name)
-			break;
+		if (!strncmp(p->name, name, len))
+			return p;
 	}
 
-	if (p == &__stop_providers)
-		p = NULL;
-
-	free(search);
-	return p;
+	return NULL;
 }
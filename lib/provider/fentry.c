@@ -0,0 +1,430 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#define _GNU_SOURCE 		/* asprintf */
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+#include "kprobe.h"
+
+#ifdef LINUX_HAS_FENTRY
+
+/* fentry/fexit programs are called from a BPF trampoline that the
+ * kernel patches into the start of the function, which is close to
+ * the cost of a direct call. The context is an array of u64's, one
+ * for each argument followed by the return value in the fexit
+ * case. That is described by a struct, generated from the function's
+ * prototype in the kernel's BTF, where every member is padded out to
+ * its own slot. */
+struct fentry {
+	struct func args_func;
+
+	char **argnames;
+	int nargs;
+
+	int fd;
+};
+
+/* args */
+
+static const struct func fentry_args_func = {
+	/* This a template - the type will be specific to each
+	 * function and will be generated dynamically. */
+	.name = "args",
+	.static_ret = 1,
+	.ctx = 1,
+
+	.rewrite = func_ctx_rewrite,
+	.ir_post = func_ctx_ir_post,
+};
+
+static struct node *fentry_member(struct node *n, const char *name)
+{
+	/* name => (*args).name */
+	return node_expr(&n->loc, ".",
+			 node_expr(&n->loc, "u*", node_expr_ident(&n->loc, "args"), NULL),
+			 node_string(&n->loc, name),
+			 NULL);
+}
+
+
+/* argN */
+
+static int fentry_arg_rewrite(const struct func *func, struct node *n,
+			      struct ply_probe *pb)
+{
+	struct fentry *fe = pb->provider_data;
+	int arg;
+
+	arg = n->expr.func[3] - '0';
+	if (arg >= fe->nargs) {
+		_e("%#N: %N is out of range, the function takes %d arguments\n",
+		   n, n, fe->nargs);
+		return -EINVAL;
+	}
+
+	node_replace(n, fentry_member(n, fe->argnames[arg]));
+	return 1;
+}
+
+static const struct func fentry_arg_func = {
+	.name = "argN",
+
+	/* the real type is only known once the rewrite is done. */
+	.type = &t_ulong,
+	.static_ret = 1,
+
+	.rewrite = fentry_arg_rewrite,
+};
+
+
+/* retval */
+
+static int fexit_retval_rewrite(const struct func *func, struct node *n,
+				struct ply_probe *pb)
+{
+	struct fentry *fe = pb->provider_data;
+	struct type *t = fe->args_func.type->ptr.type;
+
+	if (!tfields_get(t->sou.fields, "retval")) {
+		_e("%#N: %s does not return a value\n", n, pb->probe);
+		return -EINVAL;
+	}
+
+	node_replace(n, fentry_member(n, "retval"));
+	return 1;
+}
+
+static const struct func fexit_retval_func = {
+	.name = "retval",
+
+	/* the real type is only known once the rewrite is done. */
+	.type = &t_long,
+	.static_ret = 1,
+
+	.rewrite = fexit_retval_rewrite,
+};
+
+
+static int fentry_sym_alloc(struct ply_probe *pb, struct node *n)
+{
+	struct fentry *fe = pb->provider_data;
+	const struct func *func = NULL;
+	int err;
+
+	switch (n->ntype) {
+	case N_EXPR:
+		if (!strcmp(n->expr.func, "args")) {
+			func = &fe->args_func;
+			n->expr.ident = 1;
+		} else if (is_arg(n->expr.func)) {
+			func = &fentry_arg_func;
+		} else if ((pb->attach_type == BPF_TRACE_FEXIT)
+			   && !strcmp(n->expr.func, "retval")) {
+			func = &fexit_retval_func;
+			n->expr.ident = 1;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!func)
+		return -ENOENT;
+
+	err = func_static_validate(func, n);
+	if (err)
+		return err;
+
+	n->sym = sym_alloc(&pb->locals, n, func);
+
+	if (func->static_ret)
+		n->sym->type = func_return_type(func);
+	return 0;
+}
+
+
+static struct type *fentry_int_type(size_t size, int sign)
+{
+	switch (size) {
+	case 1:
+		return sign ? &t_s8 : &t_u8;
+	case 2:
+		return sign ? &t_s16 : &t_u16;
+	case 4:
+		return sign ? &t_s32 : &t_u32;
+	case 8:
+		return sign ? &t_s64 : &t_u64;
+	}
+
+	return NULL;
+}
+
+static struct type *fentry_btf_type(struct btf *btf, uint32_t id)
+{
+	const struct btf_type *t;
+	uint32_t enc;
+
+	t = btf_resolve(btf, id);
+	if (!t)
+		return NULL;
+
+	switch (btf_kind(t)) {
+	case BTF_KIND_INT:
+		enc = BTF_INT_ENCODING(*(const uint32_t *)(t + 1));
+		if (enc & BTF_INT_BOOL)
+			return &t_u8;
+
+		return fentry_int_type(t->size, enc & BTF_INT_SIGNED);
+	case BTF_KIND_ENUM:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	case BTF_KIND_ENUM64:
+#endif
+		return fentry_int_type(t->size, 1);
+	case BTF_KIND_PTR:
+		/* for now, in the future we could generate the
+		 * pointed-to type from BTF as well. */
+		return &t_ulong;
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+		/* passed by value, spread over as many slots as it
+		 * needs. */
+		return type_array_of(&t_u64, (t->size + 7) / 8);
+	}
+
+	return NULL;
+}
+
+/* the field list is kept terminated at all times, so that offsets
+ * can be checked as we go. */
+static void fentry_field_add(struct type *sou, int *n, char *name,
+			     struct type *t)
+{
+	sou->sou.fields = realloc(sou->sou.fields,
+				  sizeof(*sou->sou.fields) * (++(*n) + 1));
+	assert(sou->sou.fields);
+
+	sou->sou.fields[*n - 1] = (struct tfield) { .name = name, .type = t };
+	sou->sou.fields[*n] = (struct tfield) { .name = NULL, .type = NULL };
+}
+
+/* add a member in its own u64 slot. smaller members are padded,
+ * either before or after depending on where the kernel stores the
+ * low order bytes of the slot. */
+static void fentry_slot_add(struct type *sou, int *n, int slot,
+			    char *name, struct type *t)
+{
+	size_t size = type_sizeof(t);
+	char *pad = NULL;
+
+	if (size % sizeof(uint64_t))
+		asprintf(&pad, "__pad%d", slot);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	if (pad)
+		fentry_field_add(sou, n, pad,
+				 type_array_of(&t_u8, sizeof(uint64_t) - size));
+#endif
+
+	fentry_field_add(sou, n, name, t);
+	assert(type_offsetof(sou, name) == (ssize_t)(slot * sizeof(uint64_t)));
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (pad)
+		fentry_field_add(sou, n, pad,
+				 type_array_of(&t_u8, sizeof(uint64_t) - size));
+#endif
+}
+
+static int fentry_parse(struct ply_probe *pb, const struct btf_type *proto)
+{
+	struct fentry *fe = pb->provider_data;
+	struct type *sou = fe->args_func.type->ptr.type;
+	struct btf *btf = pb->ply->btf;
+	const struct btf_param *param;
+	struct type *t;
+	char *name;
+	int i, n = 0, slot = 0;
+
+	fe->nargs = btf_vlen(proto);
+	fe->argnames = xcalloc(fe->nargs, sizeof(*fe->argnames));
+
+	param = (const void *)(proto + 1);
+	for (i = 0; i < fe->nargs; i++, param++) {
+		if (!param->type) {
+			_e("%s: variadic functions are not supported\n",
+			   pb->probe);
+			return -ENOSYS;
+		}
+
+		t = fentry_btf_type(btf, param->type);
+		if (!t) {
+			_e("%s: argument %d is of an unsupported type\n",
+			   pb->probe, i);
+			return -ENOSYS;
+		}
+
+		/* unnamed arguments are only reachable as argN. */
+		name = (char *)btf_name(btf, param->name_off);
+		if (*name)
+			name = strdup(name);
+		else
+			asprintf(&name, "arg%d", i);
+
+		fe->argnames[i] = name;
+		fentry_slot_add(sou, &n, slot, name, t);
+		slot += (type_sizeof(t) + 7) / 8;
+	}
+
+	if ((pb->attach_type == BPF_TRACE_FEXIT) && btf_resolve(btf, proto->type)) {
+		t = fentry_btf_type(btf, proto->type);
+		if (!t) {
+			_e("%s: return value is of an unsupported type\n",
+			   pb->probe);
+			return -ENOSYS;
+		}
+
+		fentry_slot_add(sou, &n, slot, "retval", t);
+	}
+
+	return 0;
+}
+
+static int fentry_attach(struct ply_probe *pb)
+{
+	struct fentry *fe = pb->provider_data;
+
+	fe->fd = bpf_raw_tracepoint_open(NULL, pb->bpf_fd);
+	if (fe->fd < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int fentry_detach(struct ply_probe *pb)
+{
+	struct fentry *fe = pb->provider_data;
+
+	if (fe->fd >= 0)
+		close(fe->fd);
+
+	return 0;
+}
+
+static int fentry_probe_common(struct ply_probe *pb,
+			       enum bpf_attach_type attach_type)
+{
+	const struct btf_type *func, *proto;
+	struct type *args_t, *argsp_t;
+	struct fentry *fe;
+	const char *name;
+	int32_t id;
+	int err, i;
+
+	name = strchr(pb->probe, ':');
+	assert(name);
+	name++;
+
+	if (!pb->ply->btf) {
+		pb->ply->btf = btf_load(BTF_VMLINUX);
+		if (!pb->ply->btf) {
+			_e("%s: kernel BTF is not available at "
+			   BTF_VMLINUX "\n", pb->probe);
+			return -ENOENT;
+		}
+	}
+
+	id = btf_find(pb->ply->btf, name, BTF_KIND_FUNC);
+	if (id < 0) {
+		_e("%s: no function named %s in kernel BTF\n", pb->probe, name);
+		return id;
+	}
+
+	func  = btf_type(pb->ply->btf, id);
+	proto = btf_type(pb->ply->btf, func->type);
+	if (!proto || (btf_kind(proto) != BTF_KIND_FUNC_PROTO))
+		return -EINVAL;
+
+	fe = xcalloc(1, sizeof(*fe));
+	fe->fd = -1;
+	fe->args_func = fentry_args_func;
+
+	pb->provider_data = fe;
+	pb->attach_type = attach_type;
+	pb->attach_btf_id = id;
+
+	args_t  = xcalloc(1, sizeof(*args_t));
+	*args_t = (struct type) {
+		.ttype = T_STRUCT,
+		.sou = { .name = "args" },
+	};
+
+	argsp_t = xcalloc(1, sizeof(*argsp_t));
+	*argsp_t = (struct type) {
+		.ttype = T_POINTER,
+		.ptr = { .type = args_t, .bpf = 1 },
+	};
+
+	fe->args_func.type = argsp_t;
+
+	err = fentry_parse(pb, proto);
+	if (err)
+		goto err_free;
+
+	return 0;
+
+err_free:
+	free(args_t->sou.fields);
+	free(args_t);
+	free(argsp_t);
+	for (i = 0; i < fe->nargs; i++)
+		free(fe->argnames[i]);
+	free(fe->argnames);
+	free(fe);
+	pb->provider_data = NULL;
+	return err;
+}
+
+static int fentry_probe(struct ply_probe *pb)
+{
+	return fentry_probe_common(pb, BPF_TRACE_FENTRY);
+}
+
+static int fexit_probe(struct ply_probe *pb)
+{
+	return fentry_probe_common(pb, BPF_TRACE_FEXIT);
+}
+
+__ply_provider struct provider fentry = {
+	.name = "fentry",
+	.prog_type = BPF_PROG_TYPE_TRACING,
+
+	.sym_alloc = fentry_sym_alloc,
+	.probe     = fentry_probe,
+
+	.attach = fentry_attach,
+	.detach = fentry_detach,
+};
+
+__ply_provider struct provider fexit = {
+	.name = "fexit",
+	.prog_type = BPF_PROG_TYPE_TRACING,
+
+	.sym_alloc = fentry_sym_alloc,
+	.probe     = fexit_probe,
+
+	.attach = fentry_attach,
+	.detach = fentry_detach,
+};
+
+#endif	/* LINUX_HAS_FENTRY */
@@ -0,0 +1,127 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+/* interval probes run on a single cpu at a fixed rate. the timer is a
+ * perf software clock, so nothing happens in userspace until the
+ * program actually outputs something, e.g. through print(@map). */
+struct interval {
+	uint64_t period;
+
+	int evfd;
+};
+
+static const struct {
+	const char *suffix;
+	uint64_t ns;
+} interval_units[] = {
+	{ "s",  1000000000 },
+	{ "ms", 1000000 },
+	{ "us", 1000 },
+	{ "ns", 1 },
+
+	{ NULL }
+};
+
+static int interval_parse(const char *str, uint64_t *period)
+{
+	unsigned long long n;
+	char *end;
+	int i;
+
+	n = strtoull(str, &end, 0);
+	if (!n)
+		return -EINVAL;
+
+	/* plain numbers are seconds. */
+	if (!*end) {
+		*period = n * interval_units[0].ns;
+		return 0;
+	}
+
+	for (i = 0; interval_units[i].suffix; i++) {
+		if (!strcmp(end, interval_units[i].suffix)) {
+			*period = n * interval_units[i].ns;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int interval_sym_alloc(struct ply_probe *pb, struct node *n)
+{
+	/* no provider specific symbols, the context is only useful
+	 * for output. */
+	return -ENOENT;
+}
+
+static int interval_attach(struct ply_probe *pb)
+{
+	struct interval *iv = pb->provider_data;
+	struct perf_event_attr attr = {};
+
+	/* the cpu clock counts in nanoseconds, so the sample period
+	 * is the interval. */
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	attr.sample_period = iv->period;
+	attr.disabled = 1;
+
+	iv->evfd = perf_event_open_bpf(pb, &attr, 0);
+	return (iv->evfd < 0) ? iv->evfd : 0;
+}
+
+static int interval_detach(struct ply_probe *pb)
+{
+	struct interval *iv = pb->provider_data;
+
+	close(iv->evfd);
+	return 0;
+}
+
+static int interval_probe(struct ply_probe *pb)
+{
+	struct interval *iv;
+	const char *spec;
+
+	spec = strchr(pb->probe, ':');
+	assert(spec);
+	spec++;
+
+	iv = xcalloc(1, sizeof(*iv));
+	if (interval_parse(spec, &iv->period)) {
+		_e("%s: expected an interval, e.g. interval:1s or "
+		   "interval:500ms\n", pb->probe);
+		free(iv);
+		return -EINVAL;
+	}
+
+	pb->provider_data = iv;
+	return 0;
+}
+
+__ply_provider struct provider interval = {
+	.name = "interval",
+	.prog_type = BPF_PROG_TYPE_PERF_EVENT,
+
+	.sym_alloc = interval_sym_alloc,
+	.probe     = interval_probe,
+
+	.attach = interval_attach,
+	.detach = interval_detach,
+};
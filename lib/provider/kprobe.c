@@ -17,25 +17,10 @@
 #include <ply/internal.h>
 
 #include "xprobe.h"
+#include "kprobe.h"
 
 /* regs */
 
-static int kprobe_regs_ir_post(const struct func *func, struct node *n,
-			       struct ply_probe *pb)
-{
-	struct node *ctx = n->expr.args;
-
-	n->sym->irs = ctx->sym->irs;
-	return 0;
-}
-
-static int kprobe_regs_rewrite(const struct func *func, struct node *n,
-			       struct ply_probe *pb)
-{
-	node_expr_append(&n->loc, n, node_expr(&n->loc, "ctx", NULL));
-	return 0;
-}
-
 static struct type t_pt_regsp = {
 	.ttype = T_POINTER,
 
@@ -53,9 +38,10 @@ const struct func kprobe_regs_func = {
 	.name = "regs",
 	.type = &t_pt_regsp,
 	.static_ret = 1,
+	.ctx = 1,
 
-	.rewrite = kprobe_regs_rewrite,
-	.ir_post = kprobe_regs_ir_post,
+	.rewrite = func_ctx_rewrite,
+	.ir_post = func_ctx_ir_post,
 };
 
 /* caller */
@@ -94,7 +80,7 @@ static int kprobe_caller_rewrite(const struct func *func, struct node *n,
 	/* argN => (*regs).REG */
 	new = node_expr(&n->loc, ".",
 			node_expr(&n->loc, "u*", node_expr_ident(&n->loc, "regs"), NULL),
-			node_string(&n->loc, strdup(reg)),
+			node_string(&n->loc, reg),
 			NULL);
 
 	node_replace(n, new);
@@ -115,13 +101,6 @@ static const struct func kprobe_caller_func = {
 
 /* argN */
 
-static inline int is_arg(const char *name)
-{
-	return (strstr(name, "arg") == name)
-		&& (strlen(name) == 4)
-		&& (name[3] >= '0' && name[3] <= '9');
-}
-
 static int kprobe_arg_rewrite(const struct func *func, struct node *n,
 			      struct ply_probe *pb)
 {
@@ -142,14 +121,14 @@ static int kprobe_arg_rewrite(const struct func *func, struct node *n,
 	/* argN => (*regs).REG */
 	new = node_expr(&n->loc, ".",
 			node_expr(&n->loc, "u*", node_expr_ident(&n->loc, "regs"), NULL),
-			node_string(&n->loc, strdup(reg)),
+			node_string(&n->loc, reg),
 			NULL);
 
 	node_replace(n, new);
 	return 1;
 }
 
-static const struct func kprobe_arg_func = {
+const struct func kprobe_arg_func = {
 	.name = "argN",
 
 	/* for now, in the future we could read dwarf symbols to
@@ -205,11 +184,13 @@ static int kprobe_probe(struct ply_probe *pb)
 	xp = xcalloc(1, sizeof(*xp));
 	xp->type = 'p';
 	xp->ctrl_name = "kprobe_events";
+	xp->pmu = "kprobe";
 	xp->pattern = strchr(pb->probe, ':');
 	assert(xp->pattern);
 	xp->pattern++;
 
 	pb->provider_data = xp;
+	xprobe_multi_init(pb);
 	return 0;
 }
 
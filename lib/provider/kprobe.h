@@ -8,6 +8,15 @@
 #define _PLY_PROVIDER_KPROBE_H
 
 extern const struct func kprobe_regs_func;
+extern const struct func kprobe_arg_func;
+extern const struct func kretprobe_retval_func;
+
+static inline int is_arg(const char *name)
+{
+	return (strstr(name, "arg") == name)
+		&& (strlen(name) == 4)
+		&& (name[3] >= '0' && name[3] <= '9');
+}
 
 int kprobe_ir_pre(struct ply_probe *pb);
 
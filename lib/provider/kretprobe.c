@@ -35,14 +35,14 @@ static int kretprobe_retval_rewrite(const struct func *func, struct node *n,
 	/* retval => (*regs).REG */
 	new = node_expr(&n->loc, ".",
 			node_expr(&n->loc, "u*", node_expr_ident(&n->loc, "regs"), NULL),
-			node_string(&n->loc, strdup(reg)),
+			node_string(&n->loc, reg),
 			NULL);
 
 	node_replace(n, new);
 	return 1;
 }
 
-static const struct func kretprobe_retval_func = {
+const struct func kretprobe_retval_func = {
 	.name = "retval",
 
 	/* for now, in the future we could read dwarf symbols to
@@ -96,11 +96,13 @@ static int kretprobe_probe(struct ply_probe *pb)
 	xp = xcalloc(1, sizeof(*xp));
 	xp->type = 'r';
 	xp->ctrl_name = "kprobe_events";
+	xp->pmu = "kprobe";
 	xp->pattern = strchr(pb->probe, ':');
 	assert(xp->pattern);
 	xp->pattern++;
 
 	pb->provider_data = xp;
+	xprobe_multi_init(pb);
 	return 0;
 }
 
@@ -0,0 +1,73 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+#include "sample.h"
+
+struct profile {
+	struct sample smp;
+
+	unsigned long hz;
+};
+
+static int profile_attach(struct ply_probe *pb)
+{
+	struct profile *prof = pb->provider_data;
+	struct perf_event_attr attr = {};
+
+	/* a software clock works in VMs without a hardware pmu. */
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	attr.freq = 1;
+	attr.sample_freq = prof->hz;
+
+	return sample_attach(pb, &attr);
+}
+
+static int profile_probe(struct ply_probe *pb)
+{
+	struct profile *prof;
+	const char *freq;
+	char *end;
+
+	freq = strchr(pb->probe, ':');
+	assert(freq);
+	freq++;
+
+	prof = xcalloc(1, sizeof(*prof));
+	prof->hz = strtoul(freq, &end, 0);
+	if (!prof->hz || (*end && strcmp(end, "hz"))) {
+		_e("%s: expected a sampling frequency, e.g. profile:99hz\n",
+		   pb->probe);
+		free(prof);
+		return -EINVAL;
+	}
+
+	pb->provider_data = prof;
+	return 0;
+}
+
+__ply_provider struct provider profile = {
+	.name = "profile",
+	.prog_type = BPF_PROG_TYPE_PERF_EVENT,
+
+	.sym_alloc = sample_sym_alloc,
+	.probe     = profile_probe,
+
+	.attach = profile_attach,
+	.detach = sample_detach,
+};
@@ -0,0 +1,184 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+#include "kprobe.h"
+
+#ifdef LINUX_HAS_RAW_TRACEPOINT
+
+/* raw tracepoints run the program directly from the tracepoint with
+ * the arguments of the trace_<name>() call, before any of them have
+ * been copied into a perf buffer. the context is an array of u64's,
+ * one per argument. */
+struct rawtracepoint {
+	const char *name;
+	int fd;
+};
+
+/* args */
+
+#define RAW_ARG(_n) { .name = "arg" #_n, .type = &t_u64 }
+
+static struct tfield f_rawtracepoint_args[] = {
+	RAW_ARG(0), RAW_ARG(1), RAW_ARG(2), RAW_ARG(3), RAW_ARG(4),
+	RAW_ARG(5), RAW_ARG(6), RAW_ARG(7), RAW_ARG(8), RAW_ARG(9),
+
+	{ .type = NULL }
+};
+
+static struct type t_rawtracepoint_args = {
+	.ttype = T_STRUCT,
+	.sou = {
+		.name = "rawtracepoint_args",
+		.fields = f_rawtracepoint_args,
+	},
+};
+
+static struct type t_rawtracepoint_argsp = {
+	.ttype = T_POINTER,
+	.ptr = { .type = &t_rawtracepoint_args, .bpf = 1 },
+};
+
+static const struct func rawtracepoint_args_func = {
+	.name = "args",
+	.type = &t_rawtracepoint_argsp,
+	.static_ret = 1,
+	.ctx = 1,
+
+	.rewrite = func_ctx_rewrite,
+	.ir_post = func_ctx_ir_post,
+};
+
+
+/* argN */
+
+static int rawtracepoint_arg_rewrite(const struct func *func, struct node *n,
+				     struct ply_probe *pb)
+{
+	struct node *new;
+
+	/* argN => (*args).argN */
+	new = node_expr(&n->loc, ".",
+			node_expr(&n->loc, "u*", node_expr_ident(&n->loc, "args"), NULL),
+			node_string(&n->loc, n->expr.func),
+			NULL);
+
+	node_replace(n, new);
+	return 1;
+}
+
+static const struct func rawtracepoint_arg_func = {
+	.name = "argN",
+	.type = &t_u64,
+	.static_ret = 1,
+
+	.rewrite = rawtracepoint_arg_rewrite,
+};
+
+
+static int rawtracepoint_sym_alloc(struct ply_probe *pb, struct node *n)
+{
+	const struct func *func = NULL;
+	int err;
+
+	switch (n->ntype) {
+	case N_EXPR:
+		if (!strcmp(n->expr.func, "args")) {
+			func = &rawtracepoint_args_func;
+			n->expr.ident = 1;
+		} else if (is_arg(n->expr.func)) {
+			func = &rawtracepoint_arg_func;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!func)
+		return -ENOENT;
+
+	err = func_static_validate(func, n);
+	if (err)
+		return err;
+
+	n->sym = sym_alloc(&pb->locals, n, func);
+
+	if (func->static_ret)
+		n->sym->type = func_return_type(func);
+	return 0;
+}
+
+static int rawtracepoint_attach(struct ply_probe *pb)
+{
+	struct rawtracepoint *rtp = pb->provider_data;
+
+	/* the kernel refuses programs that read more arguments than
+	 * the tracepoint has. */
+	rtp->fd = bpf_raw_tracepoint_open(rtp->name, pb->bpf_fd);
+	if (rtp->fd < 0) {
+		_e("%s: unable to attach, errno:%d\n", pb->probe, errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int rawtracepoint_detach(struct ply_probe *pb)
+{
+	struct rawtracepoint *rtp = pb->provider_data;
+
+	if (rtp->fd >= 0)
+		close(rtp->fd);
+
+	return 0;
+}
+
+static int rawtracepoint_probe(struct ply_probe *pb)
+{
+	struct rawtracepoint *rtp;
+	const char *name;
+
+	name = strchr(pb->probe, ':');
+	assert(name);
+	name++;
+
+	/* accept the same sys/name format as the tracepoint
+	 * provider, though only the name is used by the kernel. */
+	if (strrchr(name, '/'))
+		name = strrchr(name, '/') + 1;
+
+	if (!*name) {
+		_e("%s: expected a tracepoint name\n", pb->probe);
+		return -EINVAL;
+	}
+
+	rtp = xcalloc(1, sizeof(*rtp));
+	rtp->name = name;
+	rtp->fd = -1;
+
+	pb->provider_data = rtp;
+	return 0;
+}
+
+__ply_provider struct provider rawtracepoint = {
+	.name = "rawtracepoint",
+	.prog_type = BPF_PROG_TYPE_RAW_TRACEPOINT,
+
+	.sym_alloc = rawtracepoint_sym_alloc,
+	.probe     = rawtracepoint_probe,
+
+	.attach = rawtracepoint_attach,
+	.detach = rawtracepoint_detach,
+};
+
+#endif	/* LINUX_HAS_RAW_TRACEPOINT */
@@ -0,0 +1,73 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+#include "kprobe.h"
+#include "sample.h"
+
+int sample_sym_alloc(struct ply_probe *pb, struct node *n)
+{
+	const struct func *func = NULL;
+	int err;
+
+	switch (n->ntype) {
+	case N_EXPR:
+		/* struct bpf_perf_event_data starts with the
+		 * registers of the interrupted context. */
+		if (!strcmp(n->expr.func, "regs")) {
+			func = &kprobe_regs_func;
+			n->expr.ident = 1;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!func)
+		return -ENOENT;
+
+	err = func_static_validate(func, n);
+	if (err)
+		return err;
+
+	n->sym = sym_alloc(&pb->locals, n, func);
+
+	if (func->static_ret)
+		n->sym->type = func_return_type(func);
+	return 0;
+}
+
+int sample_attach(struct ply_probe *pb, struct perf_event_attr *attr)
+{
+	struct sample *smp = pb->provider_data;
+
+	smp->n_evs = perf_event_attach_cpus(pb, attr, &smp->evfds);
+	if (smp->n_evs < 0)
+		return smp->n_evs;
+
+	return 0;
+}
+
+int sample_detach(struct ply_probe *pb)
+{
+	struct sample *smp = pb->provider_data;
+	int i;
+
+	for (i = 0; i < smp->n_evs; i++)
+		close(smp->evfds[i]);
+
+	free(smp->evfds);
+	return 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef _PLY_PROVIDER_SAMPLE_H
+#define _PLY_PROVIDER_SAMPLE_H
+
+struct perf_event_attr;
+
+/* providers that sample through one perf event per cpu, e.g. profile
+ * and software. must be the first member of their provider_data. */
+struct sample {
+	int *evfds;
+	int n_evs;
+};
+
+int sample_sym_alloc(struct ply_probe *pb, struct node *n);
+int sample_attach(struct ply_probe *pb, struct perf_event_attr *attr);
+int sample_detach(struct ply_probe *pb);
+
+#endif	/* _PLY_PROVIDER_SAMPLE_H */
@@ -0,0 +1,142 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+#include "sample.h"
+
+struct software_event {
+	const char *name;
+	const char *alias;
+	uint64_t config;
+
+	/* used when no period is given, roughly matching how often
+	 * each event tends to fire. */
+	uint64_t period;
+};
+
+static const struct software_event software_events[] = {
+	{ "cpu-clock", "cpu",
+	  PERF_COUNT_SW_CPU_CLOCK, 1000000 },
+	{ "task-clock", NULL,
+	  PERF_COUNT_SW_TASK_CLOCK, 1000000 },
+	{ "page-faults", "faults",
+	  PERF_COUNT_SW_PAGE_FAULTS, 100 },
+	{ "context-switches", "cs",
+	  PERF_COUNT_SW_CONTEXT_SWITCHES, 1000 },
+	{ "cpu-migrations", "migrations",
+	  PERF_COUNT_SW_CPU_MIGRATIONS, 1 },
+	{ "minor-faults", NULL,
+	  PERF_COUNT_SW_PAGE_FAULTS_MIN, 100 },
+	{ "major-faults", NULL,
+	  PERF_COUNT_SW_PAGE_FAULTS_MAJ, 1 },
+	{ "alignment-faults", NULL,
+	  PERF_COUNT_SW_ALIGNMENT_FAULTS, 1 },
+	{ "emulation-faults", NULL,
+	  PERF_COUNT_SW_EMULATION_FAULTS, 1 },
+
+	{ NULL }
+};
+
+struct software {
+	struct sample smp;
+
+	const struct software_event *ev;
+	uint64_t period;
+};
+
+static int software_attach(struct ply_probe *pb)
+{
+	struct software *sw = pb->provider_data;
+	struct perf_event_attr attr = {};
+
+	/* counters only see their own cpu, so one event is needed
+	 * per cpu. */
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = sw->ev->config;
+	attr.sample_period = sw->period;
+
+	return sample_attach(pb, &attr);
+}
+
+static const struct software_event *software_event_get(const char *name,
+						       size_t len)
+{
+	const struct software_event *ev;
+
+	for (ev = software_events; ev->name; ev++) {
+		if ((strlen(ev->name) == len) && !strncmp(ev->name, name, len))
+			return ev;
+
+		if (ev->alias && (strlen(ev->alias) == len)
+		    && !strncmp(ev->alias, name, len))
+			return ev;
+	}
+
+	return NULL;
+}
+
+/* software:<event>[:<period>] */
+static int software_probe(struct ply_probe *pb)
+{
+	const struct software_event *ev;
+	struct software *sw;
+	const char *name, *period;
+	uint64_t n;
+	char *end;
+
+	name = strchr(pb->probe, ':');
+	assert(name);
+	name++;
+
+	period = strchr(name, ':');
+
+	ev = software_event_get(name, period ? (size_t)(period - name)
+				: strlen(name));
+	if (!ev) {
+		_e("%s: unknown software event\n", pb->probe);
+		return -EINVAL;
+	}
+
+	if (period) {
+		n = strtoull(period + 1, &end, 0);
+		if (!n || *end) {
+			_e("%s: expected a sampling period, "
+			   "e.g. software:page-faults:100\n", pb->probe);
+			return -EINVAL;
+		}
+	} else {
+		n = ev->period;
+	}
+
+	sw = xcalloc(1, sizeof(*sw));
+	sw->ev = ev;
+	sw->period = n;
+
+	pb->provider_data = sw;
+	return 0;
+}
+
+__ply_provider struct provider software = {
+	.name = "software",
+	.prog_type = BPF_PROG_TYPE_PERF_EVENT,
+
+	.sym_alloc = sample_sym_alloc,
+	.probe     = software_probe,
+
+	.attach = software_attach,
+	.detach = sample_detach,
+};
@@ -0,0 +1,81 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+#ifdef LINUX_HAS_RAW_TRACEPOINT_TEST_RUN
+
+/* BEGIN and END probes are not attached to anything. they are loaded
+ * as raw tracepoint programs, which the kernel can run on demand, and
+ * are run once from ply itself when the ply is started or stopped. */
+
+static int special_run(struct ply_probe *pb)
+{
+	/* the context of a raw tracepoint, with every argument set
+	 * to zero. */
+	uint64_t args[12] = {};
+
+	if (bpf_prog_test_run(pb->bpf_fd, args, sizeof(args))) {
+		_e("%s: unable to run probe, errno:%d\n", pb->probe, errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int special_sym_alloc(struct ply_probe *pb, struct node *n)
+{
+	/* no provider specific symbols. */
+	return -ENOENT;
+}
+
+static int special_probe(struct ply_probe *pb)
+{
+	return 0;
+}
+
+static int special_attach(struct ply_probe *pb)
+{
+	return 0;
+}
+
+static int special_detach(struct ply_probe *pb)
+{
+	return 0;
+}
+
+__ply_provider struct provider begin = {
+	.name = "BEGIN",
+	.prog_type = BPF_PROG_TYPE_RAW_TRACEPOINT,
+
+	.sym_alloc = special_sym_alloc,
+	.probe     = special_probe,
+
+	.attach = special_attach,
+	.detach = special_detach,
+
+	.start = special_run,
+};
+
+__ply_provider struct provider end = {
+	.name = "END",
+	.prog_type = BPF_PROG_TYPE_RAW_TRACEPOINT,
+
+	.sym_alloc = special_sym_alloc,
+	.probe     = special_probe,
+
+	.attach = special_attach,
+	.detach = special_detach,
+
+	.stop = special_run,
+};
+
+#endif	/* LINUX_HAS_RAW_TRACEPOINT_TEST_RUN */
@@ -4,45 +4,56 @@
  * SPDX-License-Identifier: GPL-2.0
  */
 
+#define _GNU_SOURCE 		/* asprintf */
 #include <assert.h>
 #include <errno.h>
+#include <glob.h>
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <ply/ply.h>
 #include <ply/internal.h>
 
-struct tracepoint {
-	struct func data_func;	
+/* a parsed format file. the strings are kept as they appear in the
+ * file, types are only resolved once it is known which fields are
+ * actually used. */
+struct tpfield {
+	char *type;
+	char *name;
 
-	char *path;
-	int evfd;
+	uint32_t offs, size, len, sign;
 };
 
-static int tracepoint_data_ir_post(const struct func *func, struct node *n,
-				   struct ply_probe *pb)
-{
-	struct node *ctx = n->expr.args;
+struct tpformat {
+	struct tpformat *next;
 
-	n->sym->irs = ctx->sym->irs;
-	return 0;
-}
+	char *event;
+	struct tpfield *fields;
+	uint32_t n_fields;
+};
 
-static int tracepoint_data_rewrite(const struct func *func, struct node *n,
-				   struct ply_probe *pb)
-{
-	node_expr_append(&n->loc, n, node_expr(&n->loc, "ctx", NULL));
-	return 0;
-}
+/* formats seen by this process, a script can name the same
+ * tracepoints from several probes. */
+static struct tpformat *tpformats;
+
+struct tracepoint {
+	struct func data_func;	
+
+	glob_t gl;
+	int *evfds;
+};
 
 static const struct func tracepoint_data_func = {
 	/* This a template - the type will be specific to each
 	 * tracepoint and will be generated dynamically. */
 	.name = "data",
 	.static_ret = 1,
+	.ctx = 1,
 
-	.rewrite = tracepoint_data_rewrite,
-	.ir_post = tracepoint_data_ir_post,
+	.rewrite = func_ctx_rewrite,
+	.ir_post = func_ctx_ir_post,
 };
 
 static int tracepoint_sym_alloc(struct ply_probe *pb, struct node *n)
@@ -76,8 +87,8 @@ static int tracepoint_sym_alloc(struct ply_probe *pb, struct node *n)
 	return 0;
 }
 
-static struct type *tracepoint_parse_type(const char *str, unsigned long size,
-					  unsigned long sign)
+static struct type *tracepoint_parse_scalar(const char *str,
+					    unsigned long sign)
 {
 	int explicit_sign = 1;
 
@@ -100,6 +111,20 @@ static struct type *tracepoint_parse_type(const char *str, unsigned long size,
 	else if (!strcmp(str, "long long"))
 		return explicit_sign ? (sign ? &t_sllong : &t_ullong) : &t_llong;
 
+	return NULL;
+}
+
+static struct type *tracepoint_parse_type(const char *str, unsigned long size,
+					  unsigned long sign)
+{
+	struct type *t;
+
+	/* syscall arguments are stored as longs, whatever their
+	 * declared type, e.g. "unsigned int fd; size:8". */
+	t = tracepoint_parse_scalar(str, sign);
+	if (t && (type_sizeof(t) == (ssize_t)size))
+		return t;
+
 	/* Fallback to {u,s}{8,16,32,64} for all other cases. */
 	switch (size) {
 	case 1:
@@ -117,11 +142,10 @@ static struct type *tracepoint_parse_type(const char *str, unsigned long size,
 	return NULL;
 }
 
-static ssize_t tracepoint_parse_field(char *line, struct tfield *f)
+static int tpformat_parse_field(char *line, struct tpfield *f)
 {
 	char *type, *name, *array, *offs_s, *size_s, *sign_s, *save;
 	unsigned long offs, size, sign, len = 0;
-	struct type *t;
 
 	type   = strtok_r(line, ";", &save);
 	offs_s = strtok_r(NULL, ";", &save);
@@ -142,6 +166,8 @@ static ssize_t tracepoint_parse_field(char *line, struct tfield *f)
 		return -EINVAL;
 
 	name = rindex(type, ' ');
+	if (!name)
+		return -EINVAL;
 	*name++ = '\0';
 
 	array = index(name, '[');
@@ -150,72 +176,387 @@ static ssize_t tracepoint_parse_field(char *line, struct tfield *f)
 		len = strtoul(array, NULL, 0);
 		if (len == ULONG_MAX)
 			return -EINVAL;
+	}
 
-		size /= len;
+	f->type = strdup(type);
+	f->name = strdup(name);
+	assert(f->type && f->name);
+	f->offs = offs;
+	f->size = size;
+	f->len  = len;
+	f->sign = sign;
+	return 0;
+}
+
+static void tpformat_free(struct tpformat *fmt)
+{
+	uint32_t i;
+
+	for (i = 0; i < fmt->n_fields; i++) {
+		free(fmt->fields[i].type);
+		free(fmt->fields[i].name);
 	}
 
-	/* _d("type:%s name:%s len:%lu offs:%lu size:%lu sign:%lu\n", */
-	/*    type, name, len, offs, size, sign); */
+	free(fmt->fields);
+	free(fmt->event);
+	free(fmt);
+}
 
-	t = tracepoint_parse_type(type, size, sign);
-	if (!t)
-		return -EINVAL;
+static struct tpfield *tpformat_field_add(struct tpformat *fmt)
+{
+	fmt->fields = realloc(fmt->fields,
+			      (fmt->n_fields + 1) * sizeof(*fmt->fields));
+	assert(fmt->fields);
 
-	f->name = strdup(name);
-	f->type = len ? type_array_of(t, len) : t;
-	return offs;
-	
+	return memset(&fmt->fields[fmt->n_fields++], 0, sizeof(*fmt->fields));
 }
 
-static int tracepoint_parse(struct ply_probe *pb)
+static int tpformat_read(struct tpformat *fmt)
 {
-	struct tracepoint *tp = pb->provider_data;
-	struct type *t = tp->data_func.type->ptr.type;
-	FILE *fmt;
-	char line[0x80];
-	ssize_t offs;
-	int n = 0;
+	char *line = NULL;
+	size_t size = 0;
+	FILE *fp;
+	int err = 0;
 
-	fmt = fopenf("r", "%s/format", tp->path);
-	if (!fmt)
-		return -ENOENT;
+	fp = fopenf("r", TRACEPATH "events/%s/format", fmt->event);
+	if (!fp)
+		return -errno;
 
-	while (fgets(line, sizeof(line), fmt)) {
+	/* lines describing fields with long type names are well past
+	 * any fixed size buffer. */
+	while (!err && (getline(&line, &size, fp) > 0)) {
 		if (!strstr(line, "field:"))
 			continue;
 
-		t->sou.fields = realloc(t->sou.fields,
-					sizeof(*t->sou.fields)*(++n));
-		assert(t->sou.fields);
+		err = tpformat_parse_field(line, tpformat_field_add(fmt));
+		if (err)
+			fmt->n_fields--;
+	}
+
+	free(line);
+	fclose(fp);
+	return err;
+}
+
+/* events can be defined by modules, whose layouts change without
+ * the kernel changing. there is no way of telling which module owns
+ * an event, so the set of loaded modules is part of every key. */
+static uint64_t tpformat_modules_hash(void)
+{
+	static uint64_t h;
+	char name[0x40], srcversion[0x40], *line = NULL;
+	unsigned long size;
+	size_t lsize = 0;
+	FILE *fp, *sfp;
+
+	if (h)
+		return h;
+
+	h = cache_hash(0, "modules", sizeof("modules"));
+
+	fp = fopen("/proc/modules", "r");
+	if (!fp)
+		return h;
+
+	while (getline(&line, &lsize, fp) > 0) {
+		if (sscanf(line, "%63s %lu", name, &size) != 2)
+			continue;
+
+		h = cache_hash(h, name, strlen(name) + 1);
+		h = cache_hash(h, &size, sizeof(size));
+
+		sfp = fopenf("r", "/sys/module/%s/srcversion", name);
+		if (!sfp)
+			continue;
+
+		if (fgets(srcversion, sizeof(srcversion), sfp))
+			h = cache_hash(h, srcversion, strlen(srcversion) + 1);
+		fclose(sfp);
+	}
+
+	free(line);
+	fclose(fp);
+	return h;
+}
+
+/* on-disk cache, reading a few hundred format files from tracefs
+ * dominates the start-up time of scripts using wildcards. the
+ * layout of a tracepoint only changes with the kernel, which the
+ * cache key already depends on, or with its modules. */
+static uint64_t tpformat_key(const char *event)
+{
+	uint64_t m, h = cache_seed();
+
+	h = cache_hash(h, "tracepoint", sizeof("tracepoint"));
+	h = cache_hash(h, event, strlen(event) + 1);
+
+	m = tpformat_modules_hash();
+	return cache_hash(h, &m, sizeof(m));
+}
+
+static char *tpformat_fread_str(FILE *fp)
+{
+	char *str = NULL;
+	size_t size = 0;
+
+	if (getdelim(&str, &size, '\0', fp) <= 0) {
+		free(str);
+		return NULL;
+	}
+
+	return str;
+}
+
+static int tpformat_fread(struct tpformat *fmt, FILE *fp)
+{
+	struct tpfield *f;
+	uint32_t i, n;
+
+	if (!fread(&n, sizeof(n), 1, fp))
+		return -EIO;
+
+	for (i = 0; i < n; i++) {
+		f = tpformat_field_add(fmt);
+
+		if (!fread(&f->offs, sizeof(f->offs), 1, fp)
+		    || !fread(&f->size, sizeof(f->size), 1, fp)
+		    || !fread(&f->len,  sizeof(f->len),  1, fp)
+		    || !fread(&f->sign, sizeof(f->sign), 1, fp))
+			return -EIO;
+
+		f->type = tpformat_fread_str(fp);
+		f->name = tpformat_fread_str(fp);
+		if (!(f->type && f->name))
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static int tpformat_fwrite(FILE *fp, void *_fmt)
+{
+	struct tpformat *fmt = _fmt;
+	struct tpfield *f;
+
+	if (!fwrite(&fmt->n_fields, sizeof(fmt->n_fields), 1, fp))
+		return -EIO;
+
+	for (f = fmt->fields; f < &fmt->fields[fmt->n_fields]; f++) {
+		if (!fwrite(&f->offs, sizeof(f->offs), 1, fp)
+		    || !fwrite(&f->size, sizeof(f->size), 1, fp)
+		    || !fwrite(&f->len,  sizeof(f->len),  1, fp)
+		    || !fwrite(&f->sign, sizeof(f->sign), 1, fp)
+		    || !fwrite(f->type, strlen(f->type) + 1, 1, fp)
+		    || !fwrite(f->name, strlen(f->name) + 1, 1, fp))
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static int tpformat_load(struct tpformat *fmt)
+{
+	uint64_t key = 0;
+	FILE *fp = NULL;
+	int err;
+
+	if (ply_config.cache) {
+		key = tpformat_key(fmt->event);
+		fp = cache_open(key);
+	}
+
+	if (fp) {
+		err = tpformat_fread(fmt, fp);
+		fclose(fp);
+		if (!err)
+			return 0;
+
+		_d("%s: ignoring invalid cache entry\n", fmt->event);
+		while (fmt->n_fields) {
+			fmt->n_fields--;
+			free(fmt->fields[fmt->n_fields].type);
+			free(fmt->fields[fmt->n_fields].name);
+		}
+	}
+
+	err = tpformat_read(fmt);
+	if (err)
+		return err;
+
+	if (ply_config.cache) {
+		err = cache_put(key, tpformat_fwrite, fmt);
+		if (err) {
+			_d("%s: unable to cache format: %s\n",
+			   fmt->event, strerror(-err));
+		}
+	}
+
+	return 0;
+}
+
+static struct tpformat *tpformat_get(const char *event)
+{
+	struct tpformat *fmt;
 
-		offs = tracepoint_parse_field(line, &t->sou.fields[n - 1]);
-		if (offs < 0) {
-			free(t->sou.fields);
-			return offs;
+	for (fmt = tpformats; fmt; fmt = fmt->next) {
+		if (!strcmp(fmt->event, event))
+			return fmt;
+	}
+
+	fmt = xcalloc(1, sizeof(*fmt));
+	fmt->event = strdup(event);
+	assert(fmt->event);
+
+	if (tpformat_load(fmt)) {
+		tpformat_free(fmt);
+		return NULL;
+	}
+
+	fmt->next = tpformats;
+	tpformats = fmt;
+	return fmt;
+}
+
+static int tpfield_eq(const struct tpfield *a, const struct tpfield *b)
+{
+	return (a->offs == b->offs) && (a->size == b->size)
+		&& (a->len == b->len) && (a->sign == b->sign)
+		&& !strcmp(a->type, b->type) && !strcmp(a->name, b->name);
+}
+
+/* all events matched by a probe run the same program, so `data` can
+ * only describe the fields that they all agree on. for a single
+ * tracepoint that is the whole format, for e.g. syscalls/sys_enter_*
+ * it is the common fields and the syscall number. */
+static int tracepoint_data_type(struct ply_probe *pb, struct tpformat **fmts,
+				size_t n_fmts)
+{
+	struct tracepoint *tp = pb->provider_data;
+	struct type *t = tp->data_func.type->ptr.type;
+	struct tpfield *f;
+	struct type *ft;
+	uint32_t n_fields;
+	size_t i;
+
+	n_fields = fmts[0]->n_fields;
+	for (i = 1; i < n_fmts; i++) {
+		uint32_t j;
+
+		for (j = 0; j < n_fields && j < fmts[i]->n_fields; j++) {
+			if (!tpfield_eq(&fmts[0]->fields[j], &fmts[i]->fields[j]))
+				break;
 		}
 
-		assert(offs == type_offsetof(t, t->sou.fields[n - 1].name));
+		n_fields = j;
 	}
 
-	t->sou.fields = realloc(t->sou.fields, sizeof(*t->sou.fields)*(++n));
-	t->sou.fields[n -1] = (struct tfield) { .name = NULL, .type = NULL };
+	if (n_fields < fmts[0]->n_fields) {
+		_d("%s: data limited to %u common fields\n",
+		   pb->probe, n_fields);
+	}
+
+	t->sou.fields = xcalloc(n_fields + 1, sizeof(*t->sou.fields));
+
+	for (i = 0; i < n_fields; i++) {
+		f = &fmts[0]->fields[i];
+
+		ft = tracepoint_parse_type(f->type, f->len ? f->size / f->len : f->size,
+					   f->sign);
+		if (!ft)
+			return -EINVAL;
+
+		t->sou.fields[i].name = f->name;
+		t->sou.fields[i].type = f->len ? type_array_of(ft, f->len) : ft;
+
+		if (f->offs != type_offsetof(t, f->name))
+			return -EINVAL;
+	}
 
 	return 0;
 }
 
+static int tracepoint_parse(struct ply_probe *pb)
+{
+	struct tracepoint *tp = pb->provider_data;
+	struct tpformat **fmts;
+	size_t i, prefix;
+	char *event;
+	int err = 0;
+
+	fmts = xcalloc(tp->gl.gl_pathc, sizeof(*fmts));
+	prefix = strlen(TRACEPATH "events/");
+
+	for (i = 0; i < tp->gl.gl_pathc; i++) {
+		/* events/<sys>/<name>/format => <sys>/<name> */
+		event = strndup(tp->gl.gl_pathv[i] + prefix,
+				strlen(tp->gl.gl_pathv[i]) - prefix
+				- strlen("/format"));
+		assert(event);
+
+		fmts[i] = tpformat_get(event);
+		if (!fmts[i]) {
+			_e("%s: unable to parse format of %s\n", pb->probe, event);
+			err = -EINVAL;
+		}
+
+		free(event);
+		if (err)
+			goto out;
+	}
+
+	err = tracepoint_data_type(pb, fmts, tp->gl.gl_pathc);
+	if (err)
+		_e("%s: unable to describe tracepoint data\n", pb->probe);
+out:
+	free(fmts);
+	return err;
+}
+
+static int tracepoint_attach_one(size_t i, void *_pb)
+{
+	struct ply_probe *pb = _pb;
+	struct tracepoint *tp = pb->provider_data;
+	char *path;
+
+	/* perf_event_attach wants the event directory. */
+	path = strndup(tp->gl.gl_pathv[i],
+		       strlen(tp->gl.gl_pathv[i]) - strlen("/format"));
+	assert(path);
+
+	tp->evfds[i] = perf_event_attach(pb, path);
+	free(path);
+
+	return (tp->evfds[i] < 0) ? tp->evfds[i] : 0;
+}
+
 static int tracepoint_attach(struct ply_probe *pb)
 {
 	struct tracepoint *tp = pb->provider_data;
+	size_t i;
 
-	tp->evfd = perf_event_attach(pb, tp->path);
-	if (tp->evfd < 0)
-		return tp->evfd;
+	tp->evfds = xcalloc(tp->gl.gl_pathc, sizeof(*tp->evfds));
+	for (i = 0; i < tp->gl.gl_pathc; i++)
+		tp->evfds[i] = -1;
 
-	return 0;
+	return pool_run("attaching", tp->gl.gl_pathc,
+			tracepoint_attach_one, pb);
 }
 
 static int tracepoint_detach(struct ply_probe *pb)
 {
+	struct tracepoint *tp = pb->provider_data;
+	size_t i;
+
+	if (!tp->evfds)
+		return 0;
+
+	for (i = 0; i < tp->gl.gl_pathc; i++) {
+		if (tp->evfds[i] >= 0)
+			close(tp->evfds[i]);
+	}
+
+	free(tp->evfds);
+	tp->evfds = NULL;
 	return 0;
 }
 
@@ -224,8 +565,7 @@ static int tracepoint_probe(struct ply_probe *pb)
 	struct tracepoint *tp;
 	struct type *data_t, *datap_t;
 	const char *name;
-	size_t pathsz;
-	FILE *fp;
+	char *pattern;
 	int err;
 
 	tp = xcalloc(1, sizeof(*tp));
@@ -235,9 +575,16 @@ static int tracepoint_probe(struct ply_probe *pb)
 	assert(name);
 	name++;
 
-	fp = open_memstream(&tp->path, &pathsz);
-	fprintf(fp, TRACEPATH "events/%s", name);
-	fclose(fp);
+	/* only directories holding a format file are tracepoints,
+	 * this keeps e.g. syscalls/enable out of syscalls/\*. */
+	asprintf(&pattern, TRACEPATH "events/%s/format", name);
+	err = glob(pattern, 0, NULL, &tp->gl);
+	free(pattern);
+	if (err) {
+		_e("%s: no matching tracepoint\n", pb->probe);
+		err = -ENOENT;
+		goto err_free;
+	}
 
 	tp->data_func = tracepoint_data_func;
 
@@ -256,19 +603,19 @@ static int tracepoint_probe(struct ply_probe *pb)
 	tp->data_func.type = datap_t;
 
 	err = tracepoint_parse(pb);
-	if (err) {
-		_e("%s: Unable to parse tracepoint at %s\n",
-		   pb->probe, tp->path);
-		goto err_free;
-	}
+	if (err)
+		goto err_free_type;
+
 	return 0;
 
+err_free_type:
+	free(data_t->sou.fields);
+	free(data_t);
+	free(datap_t);
 err_free:
-
-	free(tp->data_func.type->ptr.type);
-	free(tp->data_func.type);
-	free(tp->path);
+	globfree(&tp->gl);
 	free(tp);
+	pb->provider_data = NULL;
 	return err;
 }
 
@@ -0,0 +1,122 @@
+/*
+ * Copyright Tobias Waldekranz <tobias@waldekranz.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ply/ply.h>
+#include <ply/internal.h>
+
+#include "xprobe.h"
+#include "kprobe.h"
+
+static int uprobe_sym_alloc(struct ply_probe *pb, struct node *n)
+{
+	struct xprobe *xp = pb->provider_data;
+	const struct func *func = NULL;
+	int err;
+
+	switch (n->ntype) {
+	case N_EXPR:
+		if (!strcmp(n->expr.func, "regs")) {
+			func = &kprobe_regs_func;
+			n->expr.ident = 1;
+		} else if (is_arg(n->expr.func)) {
+			func = &kprobe_arg_func;
+		} else if ((xp->type == 'r')
+			   && !strcmp(n->expr.func, "retval")) {
+			func = &kretprobe_retval_func;
+			n->expr.ident = 1;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!func)
+		return -ENOENT;
+
+	err = func_static_validate(func, n);
+	if (err)
+		return err;
+
+	n->sym = sym_alloc(&pb->locals, n, func);
+
+	if (func->static_ret)
+		n->sym->type = func_return_type(func);
+	return 0;
+}
+
+/* uprobe:/path/to/binary:func, where func may be a pattern, a
+ * function with an offset or a plain file offset. */
+static int uprobe_probe_common(struct ply_probe *pb, char type)
+{
+	struct xprobe *xp;
+	char *path, *func;
+
+	path = strchr(pb->probe, ':');
+	assert(path);
+	path = strdup(path + 1);
+	assert(path);
+
+	func = strrchr(path, ':');
+	if (!func || (func == path) || !func[1]) {
+		_e("%s: expected <path>:<function>\n", pb->probe);
+		free(path);
+		return -EINVAL;
+	}
+	*func++ = '\0';
+
+	xp = xcalloc(1, sizeof(*xp));
+	xp->type = type;
+	xp->ctrl_name = "uprobe_events";
+	xp->pmu = "uprobe";
+	xp->path = path;
+	xp->pattern = func;
+
+	/* symbols are optional, a plain offset can still be used
+	 * without them. */
+	xp->elf = elfsyms_open(path);
+	if (!xp->elf)
+		_w("%s: unable to read symbols from %s\n", pb->probe, path);
+
+	pb->provider_data = xp;
+	return 0;
+}
+
+static int uprobe_probe(struct ply_probe *pb)
+{
+	return uprobe_probe_common(pb, 'p');
+}
+
+static int uretprobe_probe(struct ply_probe *pb)
+{
+	return uprobe_probe_common(pb, 'r');
+}
+
+__ply_provider struct provider uprobe = {
+	.name = "uprobe",
+	.prog_type = BPF_PROG_TYPE_KPROBE,
+
+	.sym_alloc = uprobe_sym_alloc,
+	.probe     = uprobe_probe,
+
+	.attach = xprobe_attach,
+	.detach = xprobe_detach,
+};
+
+__ply_provider struct provider uretprobe = {
+	.name = "uretprobe",
+	.prog_type = BPF_PROG_TYPE_KPROBE,
+
+	.sym_alloc = uprobe_sym_alloc,
+	.probe     = uretprobe_probe,
+
+	.attach = xprobe_attach,
+	.detach = xprobe_detach,
+};
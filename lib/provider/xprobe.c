@@ -10,6 +10,7 @@
 #include <fnmatch.h>
 #include <glob.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <ply/ply.h>
@@ -17,13 +18,24 @@
 
 #include "xprobe.h"
 
+/* patterns are only expanded if there is a symbol table to match them
+ * against, otherwise the pattern is passed on to the kernel as is. */
+static int xprobe_is_pattern(struct ply_probe *pb)
+{
+	struct xprobe *xp = pb->provider_data;
+
+	return strpbrk(xp->pattern, "?*[!@")
+		&& (xp->path ? !!xp->elf : !!pb->ply->ksyms);
+}
+
 static int xprobe_stem(struct ply_probe *pb, char type, char *stem, size_t size)
 {
 	return snprintf(stem, size, "%c:%s/p%"PRIxPTR"_",
 			type, pb->ply->group, (uintptr_t)pb);
 }
 
-static int __xprobe_create(FILE *ctrl, const char *stem, const char *func)
+static int __xprobe_create(FILE *ctrl, const char *stem, const char *func,
+			   const char *def)
 {
 	char *funcname = strdup(func);
 	char *offs;
@@ -36,11 +48,60 @@ static int __xprobe_create(FILE *ctrl, const char *stem, const char *func)
 	fputs(stem,     ctrl);
 	fputs(funcname, ctrl);
 	fputc( ' ',     ctrl);
-	fputs(func,     ctrl);
+	fputs(def,      ctrl);
 	fputc('\n',     ctrl);
 
 	free(funcname);
-	return strlen(stem) + 2 * strlen(func) + 2;
+	return strlen(stem) + strlen(func) + strlen(def) + 2;
+}
+
+/* uprobes are placed at a file offset, which is resolved from the
+ * binary's symbols. `func` may also be a plain offset. */
+static int xprobe_uoffset(struct xprobe *xp, const char *func, uint64_t *offs)
+{
+	const struct elfsym *sym;
+	char *name, *plus, *end;
+	int err = 0;
+
+	name = strdup(func);
+	assert(name);
+
+	*offs = 0;
+	plus = strchr(name, '+');
+	if (plus) {
+		*plus++ = '\0';
+		*offs = strtoull(plus, NULL, 0);
+	}
+
+	sym = xp->elf ? elfsyms_get(xp->elf, name) : NULL;
+	if (sym) {
+		*offs += sym->offs;
+	} else {
+		*offs += strtoull(name, &end, 0);
+		if (*end || (end == name))
+			err = -ENOENT;
+	}
+
+	free(name);
+	return err;
+}
+
+static int xprobe_create_one(struct xprobe *xp, const char *func)
+{
+	uint64_t offs;
+	char *def;
+	int len;
+
+	if (!xp->path)
+		return __xprobe_create(xp->ctrl, xp->stem, func, func);
+
+	if (xprobe_uoffset(xp, func, &offs))
+		return -ENOENT;
+
+	asprintf(&def, "%s:%#"PRIx64, xp->path, offs);
+	len = __xprobe_create(xp->ctrl, xp->stem, func, def);
+	free(def);
+	return len;
 }
 
 static int xprobe_glob(struct ply_probe *pb, glob_t *gl)
@@ -70,33 +131,44 @@ static char *xprobe_func(struct ply_probe *pb, char *path)
 }
 
 
+static int xprobe_close_one(size_t i, void *_xp)
+{
+	struct xprobe *xp = _xp;
+
+	/* disarming a probe is slow, especially for kprobes, so this
+	 * is done in parallel. */
+	if (xp->evfds[i] >= 0)
+		close(xp->evfds[i]);
+
+	return 0;
+}
+
 int xprobe_detach(struct ply_probe *pb)
 {
 	struct xprobe *xp = pb->provider_data;
-	glob_t gl;
+	glob_t *gl = &xp->gl;
 	size_t i, evstart;
-	int err, pending;
-
-	if (!xp->ctrl)
-		return 0;
+	int err = 0, pending;
 
-	for (i = 0; i < xp->n_evs; i++)
-		close(xp->evfds[i]);
+	pool_run("detaching", xp->n_evs, xprobe_close_one, xp);
 
-	err = xprobe_glob(pb, &gl);
-	if (err)
-		return err;
+	if (xp->elf) {
+		elfsyms_free(xp->elf);
+		xp->elf = NULL;
+	}
 
-	assert(gl.gl_pathc == xp->n_evs);
+	/* probes created through the pmu are gone with their fds. */
+	if (!xp->ctrl)
+		return 0;
 
 	evstart = strlen(TRACEPATH "events/");
 	pending = 0;
 
-	for (i = 0; i < gl.gl_pathc; i++) {
+	for (i = 0; i < gl->gl_pathc; i++) {
 		fputs("-:", xp->ctrl);
 		pending += 2;
-		fputs(&gl.gl_pathv[i][evstart], xp->ctrl);
-		pending += strlen(&gl.gl_pathv[i][evstart]);
+		fputs(&gl->gl_pathv[i][evstart], xp->ctrl);
+		pending += strlen(&gl->gl_pathv[i][evstart]);
 		fputc('\n', xp->ctrl);
 		pending++;
 
@@ -112,23 +184,29 @@ int xprobe_detach(struct ply_probe *pb)
 		}
 	}
 
-	globfree(&gl);
+	globfree(gl);
 	fclose(xp->ctrl);
 	return err;
 }
 
 
+static size_t xprobe_funcs(struct ply_probe *pb, const char ***funcsp);
+
 static int xprobe_create_pattern(struct ply_probe *pb)
 {
 	struct xprobe *xp = pb->provider_data;
-	struct ksym *sym;
-	int err, pending = 0;
+	const char **funcs;
+	size_t i, n;
+	int len, err = 0, pending = 0;
 
-	ksyms_foreach(sym, pb->ply->ksyms) {
-		if (fnmatch(xp->pattern, sym->sym, FNM_EXTMATCH))
+	n = xprobe_funcs(pb, &funcs);
+
+	for (i = 0; i < n; i++) {
+		len = xprobe_create_one(xp, funcs[i]);
+		if (len < 0)
 			continue;
 
-		pending += __xprobe_create(xp->ctrl, xp->stem, sym->sym);
+		pending += len;
 		xp->n_evs++;
 
 		/* The kernel parser doesn't deal with a probe definition
@@ -136,15 +214,18 @@ static int xprobe_create_pattern(struct ply_probe *pb)
 		 * 512 bytes left, flush the buffer. */
 		if (pending > (0x1000 - 0x200)) {
 			err = fflush(xp->ctrl);
-			if (err)
-				return -errno;
+			if (err) {
+				err = -errno;
+				break;
+			}
 
 			pending = 0;
 		}
 	}
 
-	return 0;
-}	
+	free(funcs);
+	return err;
+}
 
 static int xprobe_create(struct ply_probe *pb)
 {
@@ -153,10 +234,14 @@ static int xprobe_create(struct ply_probe *pb)
 
 	xprobe_stem(pb, xp->type, xp->stem, sizeof(xp->stem));
 
-	if (strpbrk(xp->pattern, "?*[!@") && pb->ply->ksyms) {
+	if (xprobe_is_pattern(pb)) {
 		err = xprobe_create_pattern(pb);
 	} else {
-		__xprobe_create(xp->ctrl, xp->stem, xp->pattern);
+		err = xprobe_create_one(xp, xp->pattern);
+		if (err < 0)
+			return err;
+
+		err = 0;
 		xp->n_evs++;
 	}
 
@@ -165,39 +250,271 @@ static int xprobe_create(struct ply_probe *pb)
 	return err;
 }
 
+struct xprobe_work {
+	struct ply_probe *pb;
+	int (*fn)(struct ply_probe *pb, size_t i);
+};
+
+static int xprobe_work_one(size_t i, void *_w)
+{
+	struct xprobe_work *w = _w;
+
+	return w->fn(w->pb, i);
+}
+
+/* events are independent of each other, so all of them can be
+ * opened in parallel. */
+static int xprobe_attach_all(struct ply_probe *pb,
+			     int (*fn)(struct ply_probe *pb, size_t i))
+{
+	struct xprobe *xp = pb->provider_data;
+	struct xprobe_work w = { .pb = pb, .fn = fn };
+	size_t i;
+
+	xp->evfds = xcalloc(xp->n_evs ? : 1, sizeof(*xp->evfds));
+	for (i = 0; i < xp->n_evs; i++)
+		xp->evfds[i] = -1;
+
+	return pool_run("attaching", xp->n_evs, xprobe_work_one, &w);
+}
+
+static int __xprobe_attach_one(struct ply_probe *pb, size_t i)
+{
+	struct xprobe *xp = pb->provider_data;
+
+	xp->evfds[i] = perf_event_attach(pb, xp->gl.gl_pathv[i]);
+	return (xp->evfds[i] < 0) ? xp->evfds[i] : 0;
+}
+
 static int __xprobe_attach(struct ply_probe *pb)
 {
 	struct xprobe *xp = pb->provider_data;
-	glob_t gl;
-	int err, i;
+	int err;
 
-	err = xprobe_glob(pb, &gl);
+	err = xprobe_glob(pb, &xp->gl);
 	if (err)
 		return err;
 
-	if (gl.gl_pathc != xp->n_evs) {
-		_d("n:%d c:%d\n", xp->n_evs, gl.gl_pathc);
+	if (xp->gl.gl_pathc != xp->n_evs) {
+		_d("n:%d c:%d\n", xp->n_evs, xp->gl.gl_pathc);
 		pause();
 	}
-	
-	assert(gl.gl_pathc == xp->n_evs);
-	for (i = 0; i < (int)gl.gl_pathc; i++) {
-		xp->evfds[i] = perf_event_attach(pb, gl.gl_pathv[i]);
-		if (xp->evfds[i] < 0) {
-			err = xp->evfds[i];
-			break;
+
+	assert(xp->gl.gl_pathc == xp->n_evs);
+	return xprobe_attach_all(pb, __xprobe_attach_one);
+}
+
+static int xprobe_funcs_cmp(const void *_a, const void *_b)
+{
+	const char * const *a = _a, * const *b = _b;
+
+	return strcmp(*a, *b);
+}
+
+static void xprobe_funcs_add(const char ***funcsp, size_t *n, size_t *size,
+			     const char *func)
+{
+	if (*n == *size) {
+		*size = *size ? *size << 1 : 0x40;
+		*funcsp = realloc(*funcsp, *size * sizeof(**funcsp));
+		assert(*funcsp);
+	}
+
+	(*funcsp)[(*n)++] = func;
+}
+
+/* collect the names of all functions matching the probe's pattern.
+ * the same name may appear more than once in kallsyms, but each
+ * function should only be probed once. */
+static size_t xprobe_funcs(struct ply_probe *pb, const char ***funcsp)
+{
+	struct xprobe *xp = pb->provider_data;
+	const char **funcs = NULL;
+	const struct elfsym *esym;
+	struct ksym *sym;
+	size_t i, n = 0, size = 0;
+
+	if (!xprobe_is_pattern(pb)) {
+		funcs = xcalloc(1, sizeof(*funcs));
+		funcs[n++] = xp->pattern;
+		goto out;
+	}
+
+	if (xp->elf) {
+		/* already sorted and unique. */
+		elfsyms_foreach(esym, xp->elf) {
+			if (!fnmatch(xp->pattern, esym->name, FNM_EXTMATCH))
+				xprobe_funcs_add(&funcs, &n, &size, esym->name);
 		}
+		goto out;
+	}
+
+	ksyms_foreach(sym, pb->ply->ksyms) {
+		if (!fnmatch(xp->pattern, sym->sym, FNM_EXTMATCH))
+			xprobe_funcs_add(&funcs, &n, &size, sym->sym);
+	}
+
+	if (!n)
+		goto out;
+
+	qsort(funcs, n, sizeof(*funcs), xprobe_funcs_cmp);
+	for (i = 1, size = 1; i < n; i++) {
+		if (strcmp(funcs[i], funcs[size - 1]))
+			funcs[size++] = funcs[i];
+	}
+	n = size;
+
+out:
+	*funcsp = funcs;
+	return n;
+}
+
+static int xprobe_attach_pmu_one(struct ply_probe *pb, size_t i)
+{
+	struct xprobe *xp = pb->provider_data;
+	uint64_t offs = 0;
+	char *name, *plus;
+
+	if (xp->path) {
+		if (xprobe_uoffset(xp, xp->funcs[i], &offs)) {
+			_e("%s: no function named %s in %s\n",
+			   pb->probe, xp->funcs[i], xp->path);
+			return -ENOENT;
+		}
+
+		xp->evfds[i] = perf_event_attach_pmu(pb, xp->pmu_type,
+						     xp->pmu_config,
+						     xp->path, offs);
+		return (xp->evfds[i] < 0) ? xp->evfds[i] : 0;
+	}
+
+	name = strdup(xp->funcs[i]);
+	assert(name);
+
+	plus = strchr(name, '+');
+	if (plus) {
+		*plus = '\0';
+		offs = strtoull(plus + 1, NULL, 0);
 	}
 
-	globfree(&gl);
+	xp->evfds[i] = perf_event_attach_pmu(pb, xp->pmu_type, xp->pmu_config,
+					     name, offs);
+	free(name);
+	return (xp->evfds[i] < 0) ? xp->evfds[i] : 0;
+}
+
+static int xprobe_attach_pmu(struct ply_probe *pb, int type)
+{
+	struct xprobe *xp = pb->provider_data;
+	int err, bit;
+
+	xp->pmu_type = type;
+	xp->pmu_config = 0;
+
+	if (xp->type == 'r') {
+		bit = perf_event_pmu_bit(xp->pmu, "retprobe");
+		if (bit < 0)
+			return bit;
+
+		xp->pmu_config |= 1ULL << bit;
+	}
+
+	xp->n_evs = xprobe_funcs(pb, &xp->funcs);
+	if (xp->n_evs) {
+		err = xprobe_attach_all(pb, xprobe_attach_pmu_one);
+	} else {
+		_e("%s: no matching functions\n", pb->probe);
+		err = -ENOENT;
+	}
+
+	free(xp->funcs);
+	xp->funcs = NULL;
 	return err;
 }
 
+#ifdef LINUX_HAS_KPROBE_MULTI
+static int xprobe_attach_multi(struct ply_probe *pb)
+{
+	struct xprobe *xp = pb->provider_data;
+	union bpf_attr attr;
+	const char **syms;
+	size_t n;
+	int fd;
+
+	n = xprobe_funcs(pb, &syms);
+	if (!n) {
+		free(syms);
+		return -ENOENT;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.kprobe_multi.flags =
+		(xp->type == 'r') ? BPF_F_KPROBE_MULTI_RETURN : 0;
+	attr.link_create.kprobe_multi.cnt  = n;
+	attr.link_create.kprobe_multi.syms = (uintptr_t)syms;
+
+	fd = bpf_link_create(pb->bpf_fd, 0, BPF_TRACE_KPROBE_MULTI, &attr);
+	free(syms);
+	if (fd < 0)
+		return -errno;
+
+	_d("%s: attached to %zu functions\n", pb->probe, n);
+
+	xp->evfds = xcalloc(1, sizeof(*xp->evfds));
+	xp->evfds[0] = fd;
+	xp->n_evs = 1;
+	return 0;
+}
+#endif
+
+/* wildcard probes can be attached to all matching functions with a
+ * single kprobe_multi link, which requires the program to be loaded
+ * with a matching expected_attach_type. */
+void xprobe_multi_init(struct ply_probe *pb)
+{
+#ifdef LINUX_HAS_KPROBE_MULTI
+	struct xprobe *xp = pb->provider_data;
+
+	if (strpbrk(xp->pattern, "?*[!@") && pb->ply->ksyms)
+		pb->attach_type = BPF_TRACE_KPROBE_MULTI;
+#endif
+}
+
 int xprobe_attach(struct ply_probe *pb)
 {
 	struct xprobe *xp = pb->provider_data;
 	char *func;
-	int err;
+	int err, type;
+
+#ifdef LINUX_HAS_KPROBE_MULTI
+	if (pb->attach_type == BPF_TRACE_KPROBE_MULTI) {
+		err = xprobe_attach_multi(pb);
+		if (!err)
+			return 0;
+
+		/* a kprobe_multi program can not be attached to a perf
+		 * event, so it has to be reloaded as a regular one. */
+		_d("%s: unable to create kprobe_multi link (%d), "
+		   "attaching to each function\n", pb->probe, err);
+
+		close(pb->bpf_fd);
+		pb->attach_type = 0;
+		err = ply_probe_load(pb);
+		if (err)
+			return err;
+	}
+#endif
+
+	/* prefer the pmu, which does not involve tracefs at all. if
+	 * the kernel does not have it, fall back to kprobe_events. */
+	if (xp->pmu) {
+		type = perf_event_pmu_type(xp->pmu);
+		if (type >= 0)
+			return xprobe_attach_pmu(pb, type);
+
+		_d("%s: no %s pmu, using " TRACEPATH "%s\n",
+		   pb->probe, xp->pmu, xp->ctrl_name);
+	}
 
 	/* TODO: mode should be a+ and we should clean this up on
 	 * detach. */
@@ -215,8 +532,6 @@ int xprobe_attach(struct ply_probe *pb)
 	if (err)
 		goto err_close;
 
-	xp->evfds = xcalloc(xp->n_evs, sizeof(xp->evfds));
-
 	err = __xprobe_attach(pb);
 	if (err)
 		goto err_destroy;
@@ -7,19 +7,33 @@
 #ifndef _PLY_PROVIDER_XPROBE_H
 #define _PLY_PROVIDER_XPROBE_H
 
+#include <glob.h>
+
 struct xprobe {
 	FILE *ctrl;
 	const char *ctrl_name;
+	glob_t gl;
+
+	const char *pmu;
+	int pmu_type;
+	uint64_t pmu_config;
+	const char **funcs;
 
 	char *pattern;
 	char stem[0x40];
 
+	/* uprobes only, the binary and its symbols. */
+	char *path;
+	struct elfsyms *elf;
+
 	size_t n_evs;
 	int *evfds;
 
 	char type;
 };
 
+void xprobe_multi_init(struct ply_probe *pb);
+
 int xprobe_detach(struct ply_probe *pb);
 int xprobe_attach(struct ply_probe *pb);
 
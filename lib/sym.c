@@ -12,32 +12,120 @@
 
 #include <ply/internal.h>
 
+static size_t symtab_hash(const char *name)
+{
+	size_t h = 2166136261u;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static struct sym **symtab_slot(struct sym **index, size_t size,
+				const char *name)
+{
+	size_t i;
+
+	for (i = symtab_hash(name) & (size - 1); index[i];
+	     i = (i + 1) & (size - 1)) {
+		if (!strcmp(index[i]->name, name))
+			break;
+	}
+
+	return &index[i];
+}
+
+static void symtab_index_grow(struct symtab *st)
+{
+	struct sym **index, **slot, **sym;
+	size_t size, len = 0;
+
+	size = st->index_size ? st->index_size << 1 : 0x10;
+	index = acalloc(size, sizeof(*index));
+
+	/* the sym being added is already in st->syms, so it is
+	 * indexed here too. recount rather than trusting index_len. */
+	symtab_foreach(st, sym) {
+		if (!(*sym)->name)
+			continue;
+
+		slot = symtab_slot(index, size, (*sym)->name);
+		if (!*slot) {
+			*slot = *sym;
+			len++;
+		}
+	}
+
+	st->index = index;
+	st->index_size = size;
+	st->index_len = len;
+}
+
+static void symtab_index_add(struct symtab *st, struct sym *sym)
+{
+	struct sym **slot;
+
+	/* keep the load factor below 1/2 */
+	if ((st->index_len + 1) * 2 > st->index_size)
+		symtab_index_grow(st);
+
+	slot = symtab_slot(st->index, st->index_size, sym->name);
+	if (*slot)
+		return;
+
+	*slot = sym;
+	st->index_len++;
+}
+
 struct sym *__sym_alloc(struct symtab *st, const char *name,
 			const struct func *func)
 {
-	struct sym *sym;
+	struct sym **syms, *sym;
+
+	if (st->len == st->size) {
+		st->size = st->size ? st->size << 1 : 0x10;
+
+		/* the old array stays in the arena, but with doubling
+		 * that never amounts to more than the final size. */
+		syms = acalloc(st->size, sizeof(*st->syms));
+		if (st->len)
+			memcpy(syms, st->syms, st->len * sizeof(*st->syms));
+		st->syms = syms;
+	}
 
-	st->syms = realloc(st->syms, ++st->len * sizeof(*st->syms));
-	assert(st->syms);
+	sym = acalloc(1, sizeof(struct sym));
+	st->syms[st->len++] = sym;
 
-	st->syms[st->len - 1] = xcalloc(1, sizeof(struct sym));
-	sym = st->syms[st->len - 1];
 	sym->st    = st;
 	sym->name  = name;
 	sym->func  = func;
 	sym->mapfd = -1;
+
+	if (name)
+		symtab_index_add(st, sym);
+
 	return sym;
 }
 
+struct sym *sym_get(struct symtab *st, const char *name)
+{
+	if (!st->index_size)
+		return NULL;
+
+	return *symtab_slot(st->index, st->index_size, name);
+}
+
 static struct sym *sym_alloc_ident(struct symtab *st, struct node *n,
 				   const struct func *func)
 {
-	struct sym **sym;
+	struct sym *sym;
 
-	symtab_foreach(st, sym) {
-		if ((*sym)->name && !strcmp((*sym)->name, n->expr.func))
-			return *sym;
-	}
+	sym = sym_get(st, n->expr.func);
+	if (sym)
+		return sym;
 
 	return __sym_alloc(st, n->expr.func, func);
 }
@@ -0,0 +1 @@
+/usr/share/aclocal/ltoptions.m4
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <assert.h>
 #include <getopt.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,9 @@ static void usage()
 	      "  -d             Enable debug output.\n"
 	      "  -e             Exit after compiling.\n"
 	      "  -h             Print usage message and exit.\n"
+	      "  -I SECONDS     Report probe run-time every SECONDS, implies -s.\n"
+	      "  -n             Do not use the compiled program cache.\n"
+	      "  -s             Show per-probe cost, compile time and run-time.\n"
 	      "  -S             Show generated BPF.\n"
 	      "  -v             Print version information.\n",
 	      stderr);
@@ -100,11 +104,50 @@ void dump(struct ply *ply)
 
 		printf("\n-- locals\n");
 		symtab_dump(&pb->locals, stdout);
+		printf("-- stack\n%zd/%d bytes\n", -pb->ir->sp, MAX_BPF_STACK);
+		if (pb->ir->scratch_size)
+			printf("%zu bytes in %s\n", pb->ir->scratch_size,
+			       pb->ir->scratch->name);
 		printf("-- ir\n");
 		ir_dump(pb->ir, stdout);
 	}
 }
 
+void stats(struct ply *ply)
+{
+	struct ply_probe *pb;
+	struct ply_pass *pass;
+
+	ply_probe_foreach(ply, pb) {
+		fprintf(stderr, "-- %s\n", pb->probe);
+		ir_stats_dump(pb->ir, stderr);
+
+		if (pb->verified_insns)
+			fprintf(stderr, "verifier: %u insns processed\n",
+				pb->verified_insns);
+	}
+
+	fprintf(stderr, "-- compile\n");
+	for (pass = ply->passes; pass->name; pass++)
+		fprintf(stderr, "%-8s %8.3f ms\n", pass->name, pass->ns / 1e6);
+}
+
+static void runtime(struct ply *ply)
+{
+	struct ply_probe *pb;
+	uint64_t ns, cnt;
+
+	fprintf(stderr, "-- run-time\n");
+	ply_probe_foreach(ply, pb) {
+		if (ply_probe_runtime(pb, &ns, &cnt))
+			continue;
+
+		fprintf(stderr, "%s: %"PRIu64" hits, %"PRIu64" ns/hit, "
+			"%.3f ms total\n", pb->probe, cnt, cnt ? ns / cnt : 0,
+			ns / 1e6);
+	}
+}
+
 static void version()
 {
 	printf("%s (linux-version:%u~%u.%u.%u)\n",
@@ -114,12 +157,15 @@ static void version()
 	       (LINUX_VERSION_CODE >>  0) & 0xff);
 }
 
-static const char *sopts = "c:dehSv";
+static const char *sopts = "c:dehI:nsSv";
 static struct option lopts[] = {
 	{ "command", required_argument, 0, 'c' },
 	{ "debug",   no_argument,       0, 'd' },
 	{ "dry-run", no_argument,       0, 'e' },
 	{ "help",    no_argument,       0, 'h' },
+	{ "stats-interval", required_argument, 0, 'I' },
+	{ "no-cache", no_argument,      0, 'n' },
+	{ "stats",   no_argument,       0, 's' },
 	{ "dump",    no_argument,       0, 'S' },
 	{ "version", no_argument,       0, 'v' },
 
@@ -188,17 +234,24 @@ static void term(int sig)
 	return;
 }
 
+static int alarm_sig = 0;
+static void tick(int sig)
+{
+	alarm_sig = sig;
+	return;
+}
+
 int main(int argc, char **argv)
 {
 	struct ply *ply;
 	struct ply_ev *ev;
 	struct ply_return ret = { .err = 1 };
 	int opt, infpid, inftrig;
-	int f_debug, f_dryrun, f_dump;
+	int f_debug, f_dryrun, f_dump, f_stats, stats_interval = 0;
 	FILE *src;
 	char *cmd = NULL;
 
-	f_debug = f_dryrun = f_dump = 0;
+	f_debug = f_dryrun = f_dump = f_stats = 0;
 	while ((opt = getopt_long(argc, argv, sopts, lopts, NULL)) > 0) {
 		switch (opt) {
 		case 'c':
@@ -214,6 +267,20 @@ int main(int argc, char **argv)
 		case 'h':
 			usage(); exit(0);
 			break;
+		case 'I':
+			stats_interval = atoi(optarg);
+			if (stats_interval <= 0) {
+				_e("invalid interval '%s'\n", optarg);
+				usage(); exit(1);
+			}
+			f_stats = 1;
+			break;
+		case 'n':
+			ply_config.cache = 0;
+			break;
+		case 's':
+			f_stats = 1;
+			break;
 		case 'S':
 			f_dump = 1;
 			break;
@@ -253,15 +320,26 @@ int main(int argc, char **argv)
 	if (ret.val)
 		goto err;
 
-	if (f_dryrun)
+	if (f_dryrun) {
+		if (f_stats)
+			stats(ply);
 		goto unload;
+	}
 
 	memlock_uncap();
 
 	ret.val = ply_load(ply);
+
+	/* verifier results are available even if attaching failed. */
+	if (f_stats)
+		stats(ply);
+
 	if (ret.val)
 		goto err;
 
+	if (f_stats && ply_stats_enable(ply))
+		_w("unable to enable bpf run-time stats\n");
+
 	ply_start(ply);
 	fprintf(stderr, "ply: active\n");
 
@@ -270,6 +348,12 @@ int main(int argc, char **argv)
 	siginterrupt(SIGINT, 1);
 	siginterrupt(SIGCHLD, 1);
 
+	if (stats_interval) {
+		signal(SIGALRM, tick);
+		siginterrupt(SIGALRM, 1);
+		alarm(stats_interval);
+	}
+
 	if (cmd) {
 		int err = 0;
 
@@ -281,13 +365,25 @@ int main(int argc, char **argv)
 		}
 	}
 
-	ret = ply_loop(ply);
+	for (;;) {
+		ret = ply_loop(ply);
+		if (!(ret.err && (ret.val == EINTR) && alarm_sig && !term_sig))
+			break;
+
+		alarm_sig = 0;
+		runtime(ply);
+		alarm(stats_interval);
+	}
+
 	if (ret.err && (ret.val == EINTR) && term_sig)
 		ret.err = 0;
 stop:
 	fprintf(stderr, "ply: deactivating\n");
 	ply_stop(ply);
 
+	if (f_stats)
+		runtime(ply);
+
 	ply_maps_print(ply);
 
 unload: